@@ -0,0 +1,534 @@
+#include <arena/arena.h>
+#include <arena/constants.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef ARENA_BENCH_VERSION
+#define ARENA_BENCH_VERSION "unknown"
+#endif
+
+// Throughput of arena_malloc / arena_free / arena_iterate / arena_reset
+// under a few allocation patterns, next to the same patterns on malloc.
+// Every row is the best of --repeat runs, written as CSV (default) or
+// JSON so results can be compared across versions.
+
+typedef struct {
+  const char* allocator;
+  const char* pattern;
+  const char* op;
+  int64_t item_size;
+  int64_t items_per_page;
+  int64_t ops;
+  int64_t ns;
+} BenchResult;
+
+typedef struct {
+  BenchResult* items;
+  int64_t length;
+  int64_t capacity;
+} BenchResults;
+
+typedef struct {
+  int64_t count;
+  int64_t repeat;
+  bool json;
+} BenchOptions;
+
+static volatile uint64_t bench_sink;
+
+static int64_t bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift, so every run frees the same slots.
+static uint64_t bench_random(uint64_t* state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static void bench_shuffle(int64_t* order, int64_t n) {
+  uint64_t state = 0x2545F4914F6CDD1DULL;
+
+  for (int64_t i = 0; i < n; i++)
+    order[i] = i;
+
+  for (int64_t i = n - 1; i > 0; i--) {
+    int64_t j = bench_random(&state) % (i + 1);
+    int64_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+}
+
+// keeps the fastest of the repeated runs of a row.
+static void bench_record(BenchResults* results, BenchResult result) {
+  for (int64_t i = 0; i < results->length; i++) {
+    BenchResult* row = &results->items[i];
+
+    if (strcmp(row->allocator, result.allocator) == 0 &&
+        strcmp(row->pattern, result.pattern) == 0 &&
+        strcmp(row->op, result.op) == 0 && row->item_size == result.item_size &&
+        row->items_per_page == result.items_per_page) {
+      if (result.ns < row->ns)
+        *row = result;
+      return;
+    }
+  }
+
+  if (results->length >= results->capacity) {
+    results->capacity = results->capacity ? results->capacity * 2 : 64;
+    results->items = (BenchResult*)realloc(
+        results->items, results->capacity * sizeof(BenchResult));
+
+    if (!results->items) {
+      fprintf(stderr, "Failed to allocate results.\n");
+      exit(1);
+    }
+  }
+
+  results->items[results->length++] = result;
+}
+
+#define BENCH_RECORD(results, allocator_, pattern_, op_, size, per_page,      \
+                     ops_, ns_)                                               \
+  bench_record(results, (BenchResult){.allocator = allocator_,                \
+                                      .pattern = pattern_,                    \
+                                      .op = op_,                              \
+                                      .item_size = size,                      \
+                                      .items_per_page = per_page,             \
+                                      .ops = ops_,                            \
+                                      .ns = ns_})
+
+static void bench_touch(void* ptr, int64_t i) { *(int64_t*)ptr = i; }
+
+static void bench_visit(void* user_ptr, void* data_ptr) {
+  *(uint64_t*)user_ptr += *(int64_t*)data_ptr;
+}
+
+static bool bench_arena_init(Arena* arena, int64_t item_size,
+                             int64_t items_per_page) {
+  memset(arena, 0, sizeof(Arena));
+  return arena_init(arena, (ArenaConfig){.item_size = item_size,
+                                         .items_per_page = items_per_page});
+}
+
+static int64_t bench_arena_fill(Arena* arena, ArenaRef* refs, int64_t n) {
+  int64_t start = bench_now();
+
+  for (int64_t i = 0; i < n; i++)
+    bench_touch(arena_malloc(arena, &refs[i]), i);
+
+  return bench_now() - start;
+}
+
+static int64_t bench_arena_iterate(Arena* arena, int64_t* visited) {
+  ArenaIterator it = {0};
+  uint64_t sum = 0;
+  int64_t count = 0;
+  int64_t start = bench_now();
+
+  // arena_iterate also yields freed slots, only the live objects count so
+  // the row compares with the malloc one.
+  while (arena_iterate(arena, &it)) {
+    if (!it.ref.in_use)
+      continue;
+
+    sum += *(int64_t*)it.ref.ptr;
+    count++;
+  }
+
+  int64_t ns = bench_now() - start;
+  bench_sink += sum;
+  *visited = count;
+  return ns;
+}
+
+// malloc into the pages, iterate, reset, then malloc again into the pages
+// the reset kept.
+static void bench_arena_bump(BenchResults* results, BenchOptions opts,
+                             ArenaRef* refs, int64_t item_size,
+                             int64_t items_per_page) {
+  Arena arena;
+  int64_t n = opts.count;
+
+  if (!bench_arena_init(&arena, item_size, items_per_page))
+    return;
+
+  int64_t cold = bench_arena_fill(&arena, refs, n);
+  int64_t visited = 0;
+  int64_t iterate = bench_arena_iterate(&arena, &visited);
+
+  int64_t start = bench_now();
+  arena_reset(&arena);
+  int64_t reset = bench_now() - start;
+
+  int64_t warm = bench_arena_fill(&arena, refs, n);
+
+  BENCH_RECORD(results, "arena", "bump", "malloc_cold", item_size,
+               items_per_page, n, cold);
+  BENCH_RECORD(results, "arena", "bump", "malloc_warm", item_size,
+               items_per_page, n, warm);
+  BENCH_RECORD(results, "arena", "bump", "iterate", item_size, items_per_page,
+               visited, iterate);
+  BENCH_RECORD(results, "arena", "bump", "reset", item_size, items_per_page,
+               1, reset);
+
+  arena_destroy(&arena);
+}
+
+// a queue of n / 4 objects: every op frees the oldest and allocates one.
+static void bench_arena_fifo(BenchResults* results, BenchOptions opts,
+                             ArenaRef* refs, int64_t item_size,
+                             int64_t items_per_page) {
+  Arena arena;
+  int64_t window = opts.count / 4;
+
+  if (window <= 0 || !bench_arena_init(&arena, item_size, items_per_page))
+    return;
+
+  bench_arena_fill(&arena, refs, window);
+
+  int64_t start = bench_now();
+
+  for (int64_t i = 0; i < opts.count; i++) {
+    int64_t slot = i % window;
+    arena_free(refs[slot]);
+    bench_touch(arena_malloc(&arena, &refs[slot]), i);
+  }
+
+  BENCH_RECORD(results, "arena", "fifo", "malloc_free", item_size,
+               items_per_page, opts.count, bench_now() - start);
+  arena_destroy(&arena);
+}
+
+// a stack over n / 4 live objects: batches of 64 pushed and popped.
+static void bench_arena_lifo(BenchResults* results, BenchOptions opts,
+                             ArenaRef* refs, int64_t item_size,
+                             int64_t items_per_page) {
+  Arena arena;
+  int64_t base = opts.count / 4;
+  int64_t batch = 64;
+
+  if (!bench_arena_init(&arena, item_size, items_per_page))
+    return;
+
+  bench_arena_fill(&arena, refs, base + batch);
+
+  int64_t start = bench_now();
+
+  for (int64_t i = 0; i < opts.count; i += batch) {
+    for (int64_t j = base + batch - 1; j >= base; j--)
+      arena_free(refs[j]);
+    for (int64_t j = base; j < base + batch; j++)
+      bench_touch(arena_malloc(&arena, &refs[j]), j);
+  }
+
+  int64_t ops = (opts.count + batch - 1) / batch * batch;
+  BENCH_RECORD(results, "arena", "lifo", "malloc_free", item_size,
+               items_per_page, ops, bench_now() - start);
+  arena_destroy(&arena);
+}
+
+// frees a random percent of n objects, iterates what is left and
+// allocates the freed slots again.
+static void bench_arena_random(BenchResults* results, BenchOptions opts,
+                               ArenaRef* refs, const int64_t* order,
+                               const char* pattern, int64_t percent,
+                               int64_t item_size, int64_t items_per_page) {
+  Arena arena;
+  int64_t n = opts.count;
+  int64_t freed = n * percent / 100;
+
+  if (!bench_arena_init(&arena, item_size, items_per_page))
+    return;
+
+  bench_arena_fill(&arena, refs, n);
+
+  int64_t start = bench_now();
+  for (int64_t i = 0; i < freed; i++)
+    arena_free(refs[order[i]]);
+  int64_t free_ns = bench_now() - start;
+
+  int64_t visited = 0;
+  int64_t iterate = bench_arena_iterate(&arena, &visited);
+
+  uint64_t sum = 0;
+  start = bench_now();
+  int64_t live = arena_for_each(&arena, bench_visit, &sum);
+  int64_t for_each = bench_now() - start;
+  bench_sink += sum;
+
+  start = bench_now();
+  for (int64_t i = 0; i < freed; i++)
+    bench_touch(arena_malloc(&arena, &refs[order[i]]), i);
+  int64_t reuse = bench_now() - start;
+
+  BENCH_RECORD(results, "arena", pattern, "free", item_size, items_per_page,
+               freed, free_ns);
+  BENCH_RECORD(results, "arena", pattern, "iterate", item_size,
+               items_per_page, visited, iterate);
+  BENCH_RECORD(results, "arena", pattern, "for_each", item_size,
+               items_per_page, live, for_each);
+  BENCH_RECORD(results, "arena", pattern, "malloc_reuse", item_size,
+               items_per_page, freed, reuse);
+  arena_destroy(&arena);
+}
+
+static int64_t bench_malloc_fill(void** ptrs, int64_t n, int64_t item_size) {
+  int64_t start = bench_now();
+
+  for (int64_t i = 0; i < n; i++) {
+    ptrs[i] = malloc(item_size);
+    bench_touch(ptrs[i], i);
+  }
+
+  return bench_now() - start;
+}
+
+static int64_t bench_malloc_iterate(void** ptrs, int64_t n) {
+  uint64_t sum = 0;
+  int64_t start = bench_now();
+
+  for (int64_t i = 0; i < n; i++) {
+    if (ptrs[i] != 0)
+      sum += *(int64_t*)ptrs[i];
+  }
+
+  int64_t ns = bench_now() - start;
+  bench_sink += sum;
+  return ns;
+}
+
+static void bench_malloc_free_all(void** ptrs, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    free(ptrs[i]);
+    ptrs[i] = 0;
+  }
+}
+
+// the same patterns on glibc malloc, iterating a pointer array and with a
+// free of every object standing in for arena_reset.
+static void bench_malloc(BenchResults* results, BenchOptions opts,
+                         void** ptrs, const int64_t* order,
+                         int64_t item_size) {
+  int64_t n = opts.count;
+
+  int64_t fill = bench_malloc_fill(ptrs, n, item_size);
+  int64_t iterate = bench_malloc_iterate(ptrs, n);
+
+  int64_t start = bench_now();
+  bench_malloc_free_all(ptrs, n);
+  int64_t reset = bench_now() - start;
+
+  int64_t warm = bench_malloc_fill(ptrs, n, item_size);
+  bench_malloc_free_all(ptrs, n);
+
+  BENCH_RECORD(results, "malloc", "bump", "malloc_cold", item_size, 0, n, fill);
+  BENCH_RECORD(results, "malloc", "bump", "malloc_warm", item_size, 0, n, warm);
+  BENCH_RECORD(results, "malloc", "bump", "iterate", item_size, 0, n, iterate);
+  BENCH_RECORD(results, "malloc", "bump", "reset", item_size, 0, 1, reset);
+
+  int64_t window = n / 4;
+
+  if (window > 0) {
+    bench_malloc_fill(ptrs, window, item_size);
+    start = bench_now();
+
+    for (int64_t i = 0; i < n; i++) {
+      int64_t slot = i % window;
+      free(ptrs[slot]);
+      ptrs[slot] = malloc(item_size);
+      bench_touch(ptrs[slot], i);
+    }
+
+    BENCH_RECORD(results, "malloc", "fifo", "malloc_free", item_size, 0, n,
+                 bench_now() - start);
+    bench_malloc_free_all(ptrs, window);
+  }
+
+  int64_t batch = 64;
+  bench_malloc_fill(ptrs, window + batch, item_size);
+  start = bench_now();
+
+  for (int64_t i = 0; i < n; i += batch) {
+    for (int64_t j = window + batch - 1; j >= window; j--)
+      free(ptrs[j]);
+    for (int64_t j = window; j < window + batch; j++) {
+      ptrs[j] = malloc(item_size);
+      bench_touch(ptrs[j], j);
+    }
+  }
+
+  BENCH_RECORD(results, "malloc", "lifo", "malloc_free", item_size, 0,
+               (n + batch - 1) / batch * batch, bench_now() - start);
+  bench_malloc_free_all(ptrs, window + batch);
+
+  const char* patterns[] = {"random30", "sparse90"};
+  int64_t percents[] = {30, 90};
+
+  for (int64_t p = 0; p < 2; p++) {
+    int64_t freed = n * percents[p] / 100;
+    bench_malloc_fill(ptrs, n, item_size);
+
+    start = bench_now();
+    for (int64_t i = 0; i < freed; i++) {
+      free(ptrs[order[i]]);
+      ptrs[order[i]] = 0;
+    }
+    int64_t free_ns = bench_now() - start;
+
+    iterate = bench_malloc_iterate(ptrs, n);
+
+    start = bench_now();
+    for (int64_t i = 0; i < freed; i++) {
+      ptrs[order[i]] = malloc(item_size);
+      bench_touch(ptrs[order[i]], i);
+    }
+    int64_t reuse = bench_now() - start;
+
+    BENCH_RECORD(results, "malloc", patterns[p], "free", item_size, 0, freed,
+                 free_ns);
+    BENCH_RECORD(results, "malloc", patterns[p], "iterate", item_size, 0,
+                 n - freed, iterate);
+    BENCH_RECORD(results, "malloc", patterns[p], "malloc_reuse", item_size, 0,
+                 freed, reuse);
+    bench_malloc_free_all(ptrs, n);
+  }
+}
+
+static double bench_ns_per_op(BenchResult row) {
+  return row.ops > 0 ? (double)row.ns / (double)row.ops : 0.0;
+}
+
+static double bench_ops_per_sec(BenchResult row) {
+  return row.ns > 0 ? (double)row.ops * 1e9 / (double)row.ns : 0.0;
+}
+
+static void bench_write(BenchResults* results, BenchOptions opts, FILE* fp) {
+  if (!opts.json) {
+    fprintf(fp, "version,allocator,pattern,op,item_size,items_per_page,count,"
+                "ops,ns,ns_per_op,ops_per_sec\n");
+
+    for (int64_t i = 0; i < results->length; i++) {
+      BenchResult row = results->items[i];
+      fprintf(fp, "%s,%s,%s,%s,%ld,%ld,%ld,%ld,%ld,%.3f,%.0f\n",
+              ARENA_BENCH_VERSION, row.allocator, row.pattern, row.op,
+              row.item_size, row.items_per_page, opts.count, row.ops, row.ns,
+              bench_ns_per_op(row), bench_ops_per_sec(row));
+    }
+    return;
+  }
+
+  fprintf(fp, "{\n  \"version\": \"%s\",\n  \"count\": %ld,\n  \"repeat\": %ld,\n"
+              "  \"results\": [\n",
+          ARENA_BENCH_VERSION, opts.count, opts.repeat);
+
+  for (int64_t i = 0; i < results->length; i++) {
+    BenchResult row = results->items[i];
+    fprintf(fp,
+            "    {\"allocator\": \"%s\", \"pattern\": \"%s\", \"op\": \"%s\", "
+            "\"item_size\": %ld, \"items_per_page\": %ld, \"ops\": %ld, "
+            "\"ns\": %ld, \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}%s\n",
+            row.allocator, row.pattern, row.op, row.item_size,
+            row.items_per_page, row.ops, row.ns, bench_ns_per_op(row),
+            bench_ops_per_sec(row), i + 1 < results->length ? "," : "");
+  }
+
+  fprintf(fp, "  ]\n}\n");
+}
+
+static void bench_usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [--count N] [--repeat N] [--csv | --json] [--out FILE]\n",
+          name);
+}
+
+int main(int argc, char* argv[]) {
+  BenchOptions opts = {.count = 1 << 18, .repeat = 3, .json = false};
+  const char* out = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+      opts.count = atoll(argv[++i]);
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      opts.repeat = atoll(argv[++i]);
+    } else if (strcmp(argv[i], "--json") == 0) {
+      opts.json = true;
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      opts.json = false;
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      out = argv[++i];
+    } else {
+      bench_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (opts.count <= 0 || opts.repeat <= 0) {
+    bench_usage(argv[0]);
+    return 1;
+  }
+
+  const int64_t item_sizes[] = {16, 64, 256};
+  const int64_t pages[] = {16, 256, 4096};
+  const int64_t n_sizes = sizeof(item_sizes) / sizeof(item_sizes[0]);
+  const int64_t n_pages = sizeof(pages) / sizeof(pages[0]);
+
+  // room for the lifo batch on top of the largest live set.
+  ArenaRef* refs = (ArenaRef*)calloc(opts.count + 64, sizeof(ArenaRef));
+  void** ptrs = (void**)calloc(opts.count + 64, sizeof(void*));
+  int64_t* order = (int64_t*)calloc(opts.count, sizeof(int64_t));
+  BenchResults results = {0};
+
+  if (!refs || !ptrs || !order) {
+    fprintf(stderr, "Failed to allocate %ld objects.\n", opts.count);
+    return 1;
+  }
+
+  bench_shuffle(order, opts.count);
+
+  for (int64_t r = 0; r < opts.repeat; r++) {
+    for (int64_t s = 0; s < n_sizes; s++) {
+      int64_t size = item_sizes[s];
+
+      for (int64_t p = 0; p < n_pages; p++) {
+        bench_arena_bump(&results, opts, refs, size, pages[p]);
+        bench_arena_fifo(&results, opts, refs, size, pages[p]);
+        bench_arena_lifo(&results, opts, refs, size, pages[p]);
+        bench_arena_random(&results, opts, refs, order, "random30", 30, size,
+                           pages[p]);
+        bench_arena_random(&results, opts, refs, order, "sparse90", 90, size,
+                           pages[p]);
+      }
+
+      bench_malloc(&results, opts, ptrs, order, size);
+    }
+  }
+
+  FILE* fp = out ? fopen(out, "w") : stdout;
+
+  if (!fp) {
+    fprintf(stderr, "Failed to open %s.\n", out);
+    return 1;
+  }
+
+  bench_write(&results, opts, fp);
+
+  if (fp != stdout)
+    fclose(fp);
+
+  free(results.items);
+  free(order);
+  free(ptrs);
+  free(refs);
+  return 0;
+}
@@ -5,6 +5,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <arena/buffer.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 
 typedef struct {
@@ -23,11 +25,49 @@ typedef struct {
 
 ARENA_DEFINE_BUFFER(ArenaRef);
 
+// A compact reference to an object: | generation:16 | page:20 | slot:28 |.
+// The generation is bumped whenever the slot is freed, so a handle to a
+// freed object no longer resolves.
+typedef uint64_t ArenaHandle;
+
+#define ARENA_HANDLE_NULL ((ArenaHandle)0)
+#define ARENA_HANDLE_SLOT_BITS 28
+#define ARENA_HANDLE_PAGE_BITS 20
+
+// slot ids must fit both a handle and the 32 bit free_next links.
+#define ARENA_MAX_SLOTS (1LL << ARENA_HANDLE_SLOT_BITS)
+
+// An entry of the root's mark log: a mark that can still be rewound to
+// (page == 0), a slot recycled from the free list after the mark
+// (slot >= 0), or where a page stood before it was first bump allocated
+// from after the mark, for pages already written before it.
+typedef struct {
+  struct ARENA_STRUCT* page;
+  int64_t current;
+  int64_t malloc_length;
+  int64_t slot;
+  uint64_t mark;
+} ArenaMarkEntry;
+
 typedef struct ARENA_STRUCT {
   void* data;
 
-  ArenaRef* last_free_ref;
-  ArenaRef* refs;
+  // slot metadata is kept as parallel arrays indexed by slot id, a slot's
+  // address is data + id * slot_size.
+  int64_t slot_size;
+
+  // LIFO stack of freed slots, threaded through free_next by slot id.
+  int32_t* free_next;
+  int64_t free_head;
+
+  // one bit per slot: live_bits for slots in use, dirty_bits for slots
+  // holding an object whose free_function has not run yet.
+  uint64_t* live_bits;
+  uint64_t* dirty_bits;
+  int64_t bits_length;
+
+  // per slot generation, see ArenaHandle.
+  uint16_t* generations;
 
 //  ArenaArenaRefBuffer freed_memory;
 
@@ -35,21 +75,116 @@ typedef struct ARENA_STRUCT {
   volatile int64_t current;
   volatile int64_t malloc_length;
   volatile int64_t free_length;
+
+  // freed slots waiting for their free_function (eager / deferred policy).
+  int64_t pending_length;
+
+  // number of objects in use on the page.
+  int64_t live_length;
   volatile int64_t pages;
   volatile int64_t total_count;
 
   int64_t page_size;
 
+  // virtual_memory mode: bytes of address space reserved / made writable.
+  int64_t reserved;
+  int64_t committed;
+
+  // ArenaBacking flags describing how data was obtained.
+  int backing;
+
   struct ARENA_STRUCT* next;
   struct ARENA_STRUCT* prev;
 
+  // root only: page currently bump allocating, last page in the chain and
+  // the head of the list of pages holding reusable (freed) slots.
+  struct ARENA_STRUCT* root;
+  struct ARENA_STRUCT* cursor;
+  struct ARENA_STRUCT* tail;
+  struct ARENA_STRUCT* avail;
+
+  struct ARENA_STRUCT* avail_next;
+  struct ARENA_STRUCT* avail_prev;
+
+  // root only: pages whose objects have all been freed, for arena_defrag.
+  struct ARENA_STRUCT* empty;
+  struct ARENA_STRUCT* empty_next;
+  struct ARENA_STRUCT* empty_prev;
+
+  // root only: next page arena_defrag_step looks at for compaction.
+  struct ARENA_STRUCT* defrag_cursor;
+
+  // root only: page memory held by the chain and its peak, and how many
+  // slots came from free lists, bump allocation and appended pages.
+  int64_t bytes;
+  int64_t high_water_bytes;
+  int64_t reuse_count;
+  int64_t bump_count;
+  int64_t new_page_count;
+
+  int64_t index;
+  int64_t last_index;
+
+  // root only: pages by index, for resolving handles.
+  struct ARENA_STRUCT** page_table;
+  int64_t page_table_length;
+
+  // root only: indices of released pages, reused by new ones, and per
+  // index the generation the next page there counts handles from.
+  int64_t* free_indices;
+  int64_t free_indices_length;
+  uint16_t* index_generations;
+
+  // added to slot generations in handles, so handles to a released page
+  // don't resolve on the page that reuses its index.
+  uint16_t generation_base;
+
+  // mark_epoch (root only) counts the marks taken and never goes back, epoch
+  // is its value when the page was last bump allocated from while empty.
+  uint64_t mark_epoch;
+  uint64_t epoch;
+
+  // root only: the mark log, and the newest mark in it. A rewind truncates
+  // the log after its mark, releasing a page empties it.
+  ArenaMarkEntry* marks;
+  int64_t marks_length;
+  int64_t marks_capacity;
+  uint64_t mark_top;
+
+  // the newest mark the page was logged for.
+  uint64_t saved_mark;
+
+  // remote_free: slots freed by other threads, an MPSC stack threaded
+  // through free_next. The root keeps the pages that have any.
+  _Atomic int64_t remote_head;
+  struct ARENA_STRUCT* remote_next;
+  _Atomic(struct ARENA_STRUCT*) remote_pages;
+  pthread_t owner;
+
+  // remote_free: set while a slot holds no object, claimed atomically by
+  // whichever thread frees it so a second free is refused.
+  _Atomic uint64_t* freed_bits;
+
   ArenaConfig config;
 
   bool initialized;
   bool broken;
   bool is_root;
+  bool in_avail;
+  bool in_empty;
 } Arena;
 
+// A position in the arena returned by arena_mark.
+typedef struct {
+  Arena* page;
+  int64_t current;
+  int64_t malloc_length;
+
+  // its position in the mark log.
+  int64_t entry;
+  uint64_t epoch;
+} ArenaMark;
+
 
 
 
@@ -58,10 +193,45 @@ int arena_init(Arena* arena, ArenaConfig cfg);
 
 void* arena_malloc(Arena* arena, ArenaRef* ref);
 
+// place the whole batch in consecutive slots of a single page.
+#define ARENA_MALLOC_CONTIGUOUS (1 << 0)
+
+// allocates n items in one pass, writing them to ptrs and / or refs
+// (either may be null). Returns the number of items allocated, with
+// ARENA_MALLOC_CONTIGUOUS that is either n or 0.
+int64_t arena_malloc_n(Arena* arena, int64_t n, void** ptrs, ArenaRef* refs, int flags);
+
+// bump mode only: size bytes aligned to align (config.alignment when 0).
+// Requests larger than half a page get a page of their own.
+void* arena_malloc_size(Arena* arena, size_t size, size_t align);
+
 int arena_free(ArenaRef ref);
 
+// frees n refs, validating each page once per run of refs on it.
+// Returns the number of refs freed.
+int64_t arena_free_n(ArenaRef* refs, int64_t n);
+
+// frees every live object for which predicate returns true.
+int64_t arena_free_if(Arena* arena, ArenaPredicateFunction predicate, void* user_ptr);
+
+// like arena_free, for a slot that holds no constructed object:
+// free_function will not be called on it.
+int arena_release(ArenaRef ref);
+
+void* arena_malloc_handle(Arena* arena, ArenaHandle* handle);
+
+// the object a handle refers to, or null when it was freed.
+void* arena_get(Arena* arena, ArenaHandle handle);
+
+int arena_free_handle(Arena* arena, ArenaHandle handle);
+
+ArenaHandle arena_handle_from_ref(ArenaRef ref);
+
 int arena_clear(Arena* arena);
 
+// makes the calling thread the owner of the arena (see remote_free).
+int arena_set_owner(Arena* arena);
+
 int arena_destroy(Arena* arena);
 
 bool arena_is_broken(Arena arena);
@@ -73,12 +243,123 @@ typedef struct {
 
 int arena_iterate(Arena* arena, ArenaIterator* it);
 
+// up to 64 consecutive slots of a page: slot i lives at
+// base + i * stride and holds an object when bit i of live_mask is set.
+typedef struct {
+  void* base;
+  int64_t stride;
+  int64_t count;
+  uint64_t live_mask;
+} ArenaSpan;
+
+typedef void (*ArenaSpanFunction)(void* user_ptr, ArenaSpan span);
+
+// calls fn on every live object, fn may free the object it is given.
+// Returns the number of objects visited.
+int64_t arena_for_each(Arena* arena, ArenaIterFunction fn, void* user_ptr);
+
+// calls fn once per span holding at least one live object.
+// Returns the number of spans visited.
+int64_t arena_for_each_span(Arena* arena, ArenaSpanFunction fn, void* user_ptr);
+
 int64_t arena_get_allocation_count(Arena arena);
 
+// A snapshot of the whole chain, see arena_get_stats.
+typedef struct {
+  int64_t pages;
+
+  // objects in use, slots ready for reuse and freed slots still waiting
+  // for their free_function.
+  int64_t live;
+  int64_t free;
+  int64_t pending;
+
+  // slots the pages can hold, and those bump allocated so far.
+  int64_t capacity;
+  int64_t carved;
+
+  // page memory held, and the part of it holding live objects (bump mode:
+  // bytes handed out).
+  int64_t bytes_reserved;
+  int64_t bytes_used;
+  int64_t high_water_bytes;
+
+  // share of the carved slots that hold no object, 0 in bump mode.
+  double fragmentation;
+
+  // allocations served from a free list, by bumping the cursor, and pages
+  // appended to the chain.
+  int64_t reuse_count;
+  int64_t bump_count;
+  int64_t new_page_count;
+
+  // ArenaBacking flags of all pages.
+  int backing;
+} ArenaStats;
+
+// fills stats by walking the chain.
+int arena_get_stats(Arena* arena, ArenaStats* stats);
+
+void* arena_at(Arena* arena, int64_t index);
+
 int arena_reset(Arena *arena);
 
+// runs free_function on the objects freed under ARENA_DESTROY_DEFERRED and
+// makes their slots reusable. Returns the number of objects destroyed.
+int64_t arena_collect(Arena* arena);
+
+ArenaMark arena_mark(Arena* arena);
+
+// releases everything allocated after the mark, bumped or recycled from the
+// free list, running free_function on the discarded objects, and
+// invalidates marks taken after it. Objects freed after the mark stay
+// freed. arena_reset and releasing a page (arena_defrag, arena_compact,
+// ...) invalidate every mark.
+int arena_rewind(Arena* arena, ArenaMark mark);
+
 int arena_defrag(Arena *arena);
 
+// releases up to max_pages (all when negative) pages whose objects were all
+// freed, in time proportional to the pages released. Returns the count.
+int64_t arena_defrag_n(Arena* arena, int64_t max_pages);
+
+// called after an object was copied from old_ptr to new_ptr, old_ptr and
+// handles to it are invalid from then on.
+typedef void (*ArenaRelocateFunction)(void* user_ptr, void* old_ptr,
+                                      void* new_ptr, ArenaHandle new_handle);
+
+// moves the objects of sparse pages (at most ARENA_COMPACT_SPARSE_PERCENT
+// of their slots live) into free slots of denser ones and releases the
+// emptied pages. Objects are moved with memcpy, free_function is not
+// called on them. Only pages behind the cursor are compacted, and only as
+// many as the free slots elsewhere can take in. Returns the number of
+// pages released.
+int64_t arena_compact(Arena* arena, ArenaRelocateFunction fn, void* user_ptr);
+
+// limits one arena_defrag_step, a field <= 0 puts no limit on it. With
+// neither set a step does one page of work.
+typedef struct {
+  // pages released or compacted.
+  int64_t pages;
+  // wall-clock time, checked between pages.
+  int64_t nanoseconds;
+  // also move the objects off sparse pages, as arena_compact does.
+  bool compact;
+} ArenaDefragBudget;
+
+// releases empty pages, then compacts sparse pages behind the cursor
+// starting where the previous step stopped, until the budget runs out.
+// fn is called for every object moved. Returns whether work is left, a
+// compaction pass ends once it reaches the cursor.
+bool arena_defrag_step(Arena* arena, ArenaDefragBudget budget,
+                       ArenaRelocateFunction fn, void* user_ptr);
+
+// frees the empty pages past the cursor, bypassing config.page_pool.
+// Returns the number of bytes given back.
+int64_t arena_trim(Arena* arena);
+
 int arena_unuse_all(Arena* arena);
 
+bool arena_is_clean(Arena* arena);
+
 #endif
@@ -1,20 +1,79 @@
 #ifndef ARENA_CONFIG_H
 #define ARENA_CONFIG_H
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef void (*ArenaFreeFunction)(void* data);
 typedef void (*ArenaFreeFunctionWithUserPtr)(void* data, void* user_ptr);
 typedef void (*ArenaIterFunction)(void* user_ptr, void* data_ptr);
+typedef bool (*ArenaPredicateFunction)(void* user_ptr, void* data_ptr);
+typedef void (*ArenaFreeBatchFunction)(void** items, int64_t n, void* user_ptr);
+
+// see arena/pool.h
+typedef struct ARENA_PAGE_POOL ArenaPagePool;
+
+typedef enum {
+  ARENA_GROWTH_FIXED = 0,     // every page holds items_per_page
+  ARENA_GROWTH_DOUBLE,        // each new page holds twice the previous
+  ARENA_GROWTH_DOUBLE_CAPPED  // doubles up to max_items_per_page
+} ArenaGrowth;
+
+// when free_function runs on a freed object.
+typedef enum {
+  ARENA_DESTROY_LAZY = 0,  // when its slot is reused, or on reset / clear
+  ARENA_DESTROY_EAGER,     // in arena_free, in batches for batch frees
+  ARENA_DESTROY_DEFERRED   // in arena_collect or on reset / clear, the slot
+                           // is not reused until then
+} ArenaDestroyPolicy;
 
 typedef struct {
   int64_t item_size;
   int64_t items_per_page;
-//  int64_t page_size;
   int64_t alignment;
+  ArenaGrowth growth;
+  int64_t max_items_per_page;
+
+  // reserve reserve_size bytes of address space up front and grow the root
+  // page inside it instead of chaining new pages.
+  bool virtual_memory;
+  int64_t reserve_size;
+
+  // back pages of at least ARENA_HUGE_PAGE_SIZE with 2 MiB aligned memory
+  // and ask for transparent huge pages, prefault touches new memory up
+  // front instead of on first use.
+  bool huge_pages;
+  bool prefault;
+
+  // arena_free from a thread other than the owner pushes the slot onto a
+  // lock-free queue that the owner drains on its next arena_malloc.
+  bool remote_free;
+
+  // bump mode: pages are page_size bytes that arena_malloc_size carves
+  // objects of any size out of, released all at once by arena_reset.
+  // item_size and the slot based API are unused.
+  bool bump;
+  int64_t page_size;
   ArenaFreeFunction free_function;
   ArenaFreeFunctionWithUserPtr free_function_with_user_ptr;
   void* user_ptr_free;
 
+  // takes precedence over free_function, called with up to
+  // ARENA_DESTROY_BATCH objects of one page at a time.
+  ArenaFreeBatchFunction free_batch_function;
+  ArenaDestroyPolicy destroy_policy;
+
+  // pages released by arena_defrag / arena_destroy go to the pool, and new
+  // pages are taken from it before allocating.
+  ArenaPagePool* page_pool;
+
 } ArenaConfig;
 
+typedef enum {
+  ARENA_BACKING_HEAP = 1 << 0,
+  ARENA_BACKING_MMAP = 1 << 1,
+  ARENA_BACKING_VIRTUAL_MEMORY = 1 << 2,
+  ARENA_BACKING_HUGE_PAGES = 1 << 3,
+  ARENA_BACKING_PREFAULTED = 1 << 4
+} ArenaBacking;
+
 #endif
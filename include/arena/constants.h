@@ -4,5 +4,19 @@
 #define ARENA_PAGE_SIZE 2048
 #define ARENA_ITEMS_PER_PAGE 16
 #define ARENA_ALIGNMENT 4
+#define ARENA_MAX_ITEMS_PER_PAGE 65536
+#define ARENA_RESERVE_SIZE (1LL << 32)
+#define ARENA_HUGE_PAGE_SIZE (2LL * 1024 * 1024)
+#define ARENA_THREAD_CACHE_SIZE 64
+#define ARENA_THREAD_CACHE_BATCH 32
+#define ARENA_SLAB_PAGE_SIZE 65536
+#define ARENA_DESTROY_BATCH 256
+#define ARENA_POOL_MAX_BYTES (64LL * 1024 * 1024)
+#define ARENA_PARALLEL_MAX_THREADS 64
+#define ARENA_PARALLEL_CHUNK_WORDS 16
+#define ARENA_COMPACT_SPARSE_PERCENT 25
+#define ARENA_PROFILE_SAMPLE_RATE 1024
+#define ARENA_PROFILE_BUCKETS 48
+#define ARENA_PROFILE_SITES 1024
 
 #endif
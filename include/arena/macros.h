@@ -23,6 +23,11 @@
 
 #define ARENA_IS_POWER_OF_2(x) ((x != 0) && ((x & (x - 1)) == 0))
 
+#define ARENA_BITS_WORDS(n) (((n) + 63) / 64)
+#define ARENA_BIT_TEST(bits, i) (((bits)[(i) >> 6] >> ((i) & 63)) & 1ULL)
+#define ARENA_BIT_SET(bits, i) ((bits)[(i) >> 6] |= (1ULL << ((i) & 63)))
+#define ARENA_BIT_CLEAR(bits, i) ((bits)[(i) >> 6] &= ~(1ULL << ((i) & 63)))
+
 
 #define ARENA_WARNING(...)                                                      \
   {                                                                            \
@@ -0,0 +1,24 @@
+#ifndef ARENA_PARALLEL_H
+#define ARENA_PARALLEL_H
+#include <arena/arena.h>
+#include <arena/constants.h>
+#include <stdint.h>
+
+// thread_index is in [0, nthreads) and stays the same for a whole chunk,
+// use it to index per-thread accumulators for reductions.
+typedef void (*ArenaParallelFunction)(void* user_ptr, void* data_ptr,
+                                      int64_t thread_index);
+
+// calls fn on every live object using nthreads threads (the number of
+// online CPUs when <= 0, the caller counts as one). Pages are split into
+// chunks of ARENA_PARALLEL_CHUNK_WORDS * 64 slots that threads pick up as
+// they finish the previous one. fn must not allocate or free in the arena.
+// Returns the number of objects visited.
+int64_t arena_parallel_for_each(Arena* arena, ArenaParallelFunction fn,
+                                void* user_ptr, int64_t nthreads);
+
+// stops and joins the worker threads, they are started again on the next
+// arena_parallel_for_each.
+int arena_parallel_shutdown();
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef ARENA_POOL_H
+#define ARENA_POOL_H
+#include <arena/arena.h>
+#include <arena/constants.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pages released by arena_defrag and arena_destroy, kept together with
+// their data and slot metadata for the next page of the same shape. A pool
+// can serve one arena or be shared by many (see config.page_pool).
+struct ARENA_PAGE_POOL {
+  pthread_mutex_t lock;
+
+  // pooled pages, linked through next.
+  Arena* pages;
+  int64_t length;
+  int64_t bytes;
+
+  // high-water mark, pages that would take the pool past it are freed.
+  int64_t max_bytes;
+
+  // page structs whose memory was handed out, reused for new pages.
+  Arena* spare;
+
+  // the page table of a destroyed root, with its free indices and index
+  // generations, kept for the next root.
+  Arena** page_table;
+  int64_t* free_indices;
+  uint16_t* index_generations;
+  int64_t page_table_length;
+
+  bool initialized;
+};
+
+// max_bytes defaults to ARENA_POOL_MAX_BYTES.
+int arena_page_pool_init(ArenaPagePool* pool, int64_t max_bytes);
+
+int arena_page_pool_destroy(ArenaPagePool* pool);
+
+// frees pooled pages until at most max_bytes are kept.
+// Returns the number of bytes given back.
+int64_t arena_page_pool_trim(ArenaPagePool* pool, int64_t max_bytes);
+
+// hands a reset page's memory to the pool. When owned, the pool takes the
+// page struct as well. Returns false when the page is not kept.
+bool arena_page_pool_put(ArenaPagePool* pool, Arena* page, bool owned);
+
+// moves the memory of a pooled page with the same slot_size, page_size and
+// items_per_page into page, which must have none.
+bool arena_page_pool_take(ArenaPagePool* pool, Arena* page);
+
+// keeps the page table of a destroyed root, unless the pool already holds
+// one. Returns false when it is not kept.
+bool arena_page_pool_put_table(ArenaPagePool* pool, Arena* root);
+
+// moves the kept page table, cleared, into root, which must have none.
+bool arena_page_pool_take_table(ArenaPagePool* pool, Arena* root);
+
+// a zeroed page struct, reusing a spare one when there is any.
+Arena* arena_page_pool_new_page(ArenaPagePool* pool);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef ARENA_PROFILE_H
+#define ARENA_PROFILE_H
+#include <arena/arena.h>
+#include <arena/constants.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Allocation profiling, built in with -DARENA_PROFILE (the ARENA_PROFILE
+// CMake option). Without it the hooks below compile to nothing and
+// arena_profile_start fails. Built in but stopped, each hooked call costs
+// a relaxed load and a branch.
+
+typedef enum {
+  ARENA_PROFILE_MALLOC,
+  ARENA_PROFILE_FREE,
+  ARENA_PROFILE_RESET,
+  ARENA_PROFILE_OPS
+} ArenaProfileOp;
+
+typedef enum { ARENA_PROFILE_TEXT, ARENA_PROFILE_JSON } ArenaProfileFormat;
+
+// starts recording. Every sample_rate-th allocation of a thread
+// (ARENA_PROFILE_SAMPLE_RATE when <= 0) records its call site, and so does
+// every allocation that appends a page. Latencies of arena_malloc*,
+// arena_free* and arena_reset go into histograms whose bucket i holds the
+// calls that took less than 2^i ns.
+int arena_profile_start(int64_t sample_rate);
+
+int arena_profile_stop();
+
+// forgets the sites and histograms recorded so far.
+int arena_profile_clear();
+
+// copies the ARENA_PROFILE_BUCKETS counts of an operation into buckets.
+int arena_profile_histogram(ArenaProfileOp op, int64_t* buckets);
+
+// writes the histograms and the call sites, most growth first.
+int arena_profile_dump(const char* path, ArenaProfileFormat format);
+
+#ifdef ARENA_PROFILE
+
+typedef struct {
+  int64_t start;
+  int64_t new_pages;
+} ArenaProfileScope;
+
+extern _Atomic bool arena_profile_enabled;
+
+int64_t arena_profile_now();
+
+void arena_profile_leave(ArenaProfileScope* scope, ArenaProfileOp op,
+                         Arena* arena, int64_t count, void* site);
+
+static inline ArenaProfileScope arena_profile_enter(Arena* arena) {
+  if (!atomic_load_explicit(&arena_profile_enabled, memory_order_relaxed))
+    return (ArenaProfileScope){0};
+
+  return (ArenaProfileScope){
+      .start = arena_profile_now(),
+      .new_pages = arena != 0 ? arena->new_page_count : 0};
+}
+
+#define ARENA_PROFILE_BEGIN(scope, arena)                                      \
+  ArenaProfileScope scope = arena_profile_enter(arena)
+
+// site is the caller of the function expanding it.
+#define ARENA_PROFILE_END(scope, op, arena, count)                             \
+  do {                                                                         \
+    if (scope.start != 0)                                                      \
+      arena_profile_leave(&scope, op, arena, count,                            \
+                          __builtin_return_address(0));                        \
+  } while (0)
+
+#else
+
+#define ARENA_PROFILE_BEGIN(scope, arena)
+#define ARENA_PROFILE_END(scope, op, arena, count)
+
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef ARENA_SHARED_H
+#define ARENA_SHARED_H
+#include <arena/arena.h>
+#include <arena/constants.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// An Arena that can be used from several threads. Every thread allocates
+// and frees through its own ArenaThreadCache, which only takes the lock to
+// refill or flush a batch of slots.
+typedef struct {
+  Arena arena;
+  pthread_mutex_t lock;
+  bool initialized;
+} ArenaShared;
+
+typedef struct {
+  ArenaShared* shared;
+
+  ArenaRef refs[ARENA_THREAD_CACHE_SIZE];
+
+  // slot holds an object freed by this thread that still needs its
+  // free_function before it is handed out again.
+  bool dirty[ARENA_THREAD_CACHE_SIZE];
+  int64_t length;
+
+  ArenaFreeFunction free_function;
+  ArenaFreeFunctionWithUserPtr free_function_with_user_ptr;
+  ArenaFreeBatchFunction free_batch_function;
+  void* user_ptr_free;
+  ArenaDestroyPolicy destroy_policy;
+} ArenaThreadCache;
+
+int arena_shared_init(ArenaShared* shared, ArenaConfig cfg);
+
+int arena_shared_destroy(ArenaShared* shared);
+
+int arena_thread_cache_init(ArenaThreadCache* cache, ArenaShared* shared);
+
+void* arena_shared_malloc(ArenaThreadCache* cache, ArenaRef* ref);
+
+int arena_shared_free(ArenaThreadCache* cache, ArenaRef ref);
+
+// hands every cached slot back to the shared arena, call before a thread
+// exits and before arena_shared_destroy.
+int arena_thread_cache_flush(ArenaThreadCache* cache);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef ARENA_SLAB_H
+#define ARENA_SLAB_H
+#include <arena/arena.h>
+#include <arena/constants.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// size classes: 16 byte steps up to 256, then four per power of two up to
+// ARENA_SLAB_MAX_SIZE. Larger requests fall back to malloc.
+#define ARENA_SLAB_CLASSES 32
+#define ARENA_SLAB_MAX_SIZE 4096
+
+// returned pointers are aligned like malloc's.
+#define ARENA_SLAB_ALIGNMENT 16
+
+typedef struct {
+  char* data;
+  Arena* page;
+} ArenaSlabPage;
+
+// A general purpose allocator routing each size to the Arena of its size
+// class, so objects of mixed sizes don't need an arena per type.
+typedef struct {
+  Arena classes[ARENA_SLAB_CLASSES];
+
+  // the pages of every class sorted by address, a freed pointer finds its
+  // page here instead of in a header in front of every object. Pointers
+  // outside all of them came from the malloc fallback.
+  ArenaSlabPage* pages;
+  int64_t pages_length;
+  int64_t pages_capacity;
+
+  ArenaConfig config;
+  bool initialized;
+} ArenaSlab;
+
+// cfg is used for every class, item_size and items_per_page are derived
+// from the class and free functions are not supported. The class arenas
+// must not be defragged or trimmed behind the slab's back.
+int arena_slab_init(ArenaSlab* slab, ArenaConfig cfg);
+
+int arena_slab_destroy(ArenaSlab* slab);
+
+void* arena_slab_malloc(ArenaSlab* slab, size_t size);
+
+int arena_slab_free(ArenaSlab* slab, void* ptr);
+
+// the usable size of a pointer returned by arena_slab_malloc, 0 for the
+// malloc fallback.
+size_t arena_slab_size(ArenaSlab* slab, void* ptr);
+
+#endif
@@ -1,14 +1,388 @@
 #include <arena/arena.h>
 #include <arena/constants.h>
 #include <arena/macros.h>
+#include <arena/pool.h>
+#include <arena/profile.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 ARENA_IMPLEMENT_BUFFER(ArenaRef);
 
-static bool arena_ref_can_be_used(ArenaRef ref) {
-  return ref.in_use == false && ref.ptr != 0 && ref.arena != 0 &&
-	 ref.data_size > 0;
+static Arena *arena_get_root(Arena *arena);
+static int arena_reset_(Arena *arena);
+static void arena_drop_page(Arena *root, Arena *page);
+static void arena_mark_reuse(Arena *page, int64_t id);
+
+static void *arena_slot_ptr(Arena *arena, int64_t id) {
+  return (char *)arena->data + id * arena->slot_size;
+}
+
+// slot metadata is not stored per slot, refs are derived from the index.
+static ArenaRef arena_make_ref(Arena *arena, int64_t id) {
+  return (ArenaRef){.page = arena->index,
+                    .data_start = id * arena->slot_size,
+                    .data_size = arena->slot_size,
+                    .ptr = arena_slot_ptr(arena, id),
+                    .arena = arena,
+                    .id = id,
+                    .in_use = ARENA_BIT_TEST(arena->live_bits, id) != 0};
+}
+
+// capacity of the page following one that holds `items`, growth stops at
+// the slots a handle can address.
+static int64_t arena_next_page_items(ArenaConfig cfg, int64_t items) {
+  switch (cfg.growth) {
+  case ARENA_GROWTH_DOUBLE:
+    return MIN(items * 2, MAX(items, ARENA_MAX_SLOTS));
+  case ARENA_GROWTH_DOUBLE_CAPPED:
+    return MIN(MIN(items * 2, MAX(cfg.max_items_per_page, items)),
+               MAX(items, ARENA_MAX_SLOTS));
+  case ARENA_GROWTH_FIXED:
+  default:
+    return cfg.items_per_page;
+  }
+}
+
+// index of the first set bit in [from, end), or -1.
+static int64_t arena_bits_next(const uint64_t *bits, int64_t from,
+                               int64_t end) {
+  if (!bits || from >= end)
+    return -1;
+
+  int64_t word = from >> 6;
+  uint64_t w = bits[word] & (~0ULL << (from & 63));
+
+  while (true) {
+    if (w != 0) {
+      int64_t i = (word << 6) + __builtin_ctzll(w);
+      return i < end ? i : -1;
+    }
+
+    word++;
+    if ((word << 6) >= end)
+      return -1;
+    w = bits[word];
+  }
+}
+
+static void arena_destroy_items(Arena *arena, void **items, int64_t n) {
+  if (n <= 0)
+    return;
+
+  if (arena->config.free_batch_function != 0) {
+    arena->config.free_batch_function(items, n, arena->config.user_ptr_free);
+    return;
+  }
+
+  for (int64_t i = 0; i < n; i++) {
+    if (arena->config.free_function != 0) {
+      arena->config.free_function(items[i]);
+    } else if (arena->config.free_function_with_user_ptr != 0) {
+      arena->config.free_function_with_user_ptr(items[i], arena->config.user_ptr_free);
+    }
+  }
+}
+
+// runs the destructors of the dirty slots in [start, end), skipping live
+// ones unless with_live. Returns the number of slots destroyed.
+static int64_t arena_destroy_range(Arena *arena, int64_t start, int64_t end,
+                                   bool with_live) {
+  void *batch[ARENA_DESTROY_BATCH];
+  int64_t n = 0;
+  int64_t total = 0;
+  int64_t id = arena_bits_next(arena->dirty_bits, start, end);
+
+  for (; id >= 0; id = arena_bits_next(arena->dirty_bits, id + 1, end)) {
+    if (!with_live && ARENA_BIT_TEST(arena->live_bits, id))
+      continue;
+
+    batch[n++] = arena_slot_ptr(arena, id);
+
+    if (n == ARENA_DESTROY_BATCH) {
+      arena_destroy_items(arena, batch, n);
+      total += n;
+      n = 0;
+    }
+  }
+
+  arena_destroy_items(arena, batch, n);
+  return total + n;
+}
+
+// keeps root->bytes in step as a page obtains or gives back memory.
+static void arena_account_bytes(Arena *page, int64_t delta) {
+  Arena *root = page->root;
+
+  if (root == 0 || delta == 0)
+    return;
+
+  root->bytes += delta;
+  root->high_water_bytes = MAX(root->high_water_bytes, root->bytes);
+}
+
+static int64_t arena_os_page_size() {
+  static int64_t page_size = 0;
+
+  if (page_size <= 0) {
+    page_size = sysconf(_SC_PAGESIZE);
+    page_size = page_size > 0 ? page_size : 4096;
+  }
+
+  return page_size;
+}
+
+// realloc, zeroing the grown tail.
+static void *arena_grow_array(void *ptr, int64_t length, int64_t new_length,
+                              int64_t item_size) {
+  char *next = (char *)realloc(ptr, new_length * item_size);
+  if (!next)
+    return 0;
+
+  memset(next + length * item_size, 0, (new_length - length) * item_size);
+  return next;
+}
+
+// mmap size bytes aligned to align, trimming the over-mapped head and tail.
+static void *arena_map_aligned(int64_t size, int64_t align, int prot,
+                               int flags) {
+  char *raw = (char *)mmap(0, size + align, prot, flags, -1, 0);
+  if (raw == MAP_FAILED)
+    return 0;
+
+  char *start = (char *)ARENA_ALIGN_UP((uintptr_t)raw, (uintptr_t)align);
+  int64_t head = start - raw;
+  int64_t tail = align - head;
+
+  if (head > 0)
+    munmap(raw, head);
+  if (tail > 0)
+    munmap(start + size, tail);
+
+  return start;
+}
+
+static void arena_prefault(Arena *arena, void *data, int64_t size) {
+  if (!arena->config.prefault || !data || size <= 0)
+    return;
+
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(data, size, MADV_POPULATE_WRITE) == 0) {
+    arena->backing |= ARENA_BACKING_PREFAULTED;
+    return;
+  }
+#endif
+
+  volatile char *bytes = (volatile char *)data;
+  for (int64_t i = 0; i < size; i += arena_os_page_size())
+    bytes[i] = bytes[i];
+
+  arena->backing |= ARENA_BACKING_PREFAULTED;
+}
+
+static void arena_request_huge_pages(Arena *arena, void *data, int64_t size) {
+#ifdef MADV_HUGEPAGE
+  if (madvise(data, size, MADV_HUGEPAGE) == 0)
+    arena->backing |= ARENA_BACKING_HUGE_PAGES;
+#endif
+}
+
+static bool arena_vm_reserve(Arena *arena, int64_t min_size) {
+  int64_t reserve = MAX(OR(arena->config.reserve_size, ARENA_RESERVE_SIZE),
+                        min_size);
+  int64_t align =
+      arena->config.huge_pages ? ARENA_HUGE_PAGE_SIZE : arena_os_page_size();
+  reserve = ARENA_ALIGN_UP(reserve, align);
+
+  void *data = arena_map_aligned(reserve, align, PROT_NONE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+  if (!data)
+    return false;
+
+  arena->data = data;
+  arena->reserved = reserve;
+  arena->committed = 0;
+  arena->backing = ARENA_BACKING_MMAP | ARENA_BACKING_VIRTUAL_MEMORY;
+
+  if (arena->config.huge_pages)
+    arena_request_huge_pages(arena, data, reserve);
+
+  return true;
+}
+
+static bool arena_vm_commit(Arena *arena, int64_t size) {
+  size = ARENA_ALIGN_UP(size, arena_os_page_size());
+
+  if (size > arena->reserved)
+    return false;
+  if (size <= arena->committed)
+    return true;
+
+  char *start = (char *)arena->data + arena->committed;
+  int64_t length = size - arena->committed;
+
+  if (mprotect(start, length, PROT_READ | PROT_WRITE) != 0)
+    return false;
+
+  arena->committed = size;
+  arena_prefault(arena, start, length);
+  return true;
+}
+
+// doubles the capacity of a virtual_memory page in place, the data never
+// moves so pointers handed out stay valid.
+static bool arena_vm_grow(Arena *arena) {
+  int64_t size = arena->slot_size;
+  int64_t items = arena->config.items_per_page;
+  int64_t next = MIN(MIN(items * 2, arena->reserved / size), ARENA_MAX_SLOTS);
+
+  if (next <= items || !arena_vm_commit(arena, next * size))
+    return false;
+
+  int64_t words = ARENA_BITS_WORDS(next);
+
+  int32_t *free_next = arena_grow_array(arena->free_next, items, next, sizeof(int32_t));
+  if (free_next) arena->free_next = free_next;
+  uint64_t *live_bits = arena_grow_array(arena->live_bits, arena->bits_length, words, sizeof(uint64_t));
+  if (live_bits) arena->live_bits = live_bits;
+  uint64_t *dirty_bits = arena_grow_array(arena->dirty_bits, arena->bits_length, words, sizeof(uint64_t));
+  if (dirty_bits) arena->dirty_bits = dirty_bits;
+  uint16_t *generations = arena_grow_array(arena->generations, items, next, sizeof(uint16_t));
+  if (generations) arena->generations = generations;
+
+  if (!free_next || !live_bits || !dirty_bits || !generations)
+    return false;
+
+  arena->bits_length = words;
+  arena->config.items_per_page = next;
+  arena->page_size = next * size;
+  arena_account_bytes(arena, arena->page_size - arena->size);
+  arena->size = arena->page_size;
+  return true;
+}
+
+static bool arena_alloc_data(Arena *arena, int64_t size) {
+  arena->backing = 0;
+
+  if (arena->config.virtual_memory) {
+    if (!arena_vm_reserve(arena, size))
+      return false;
+
+    if (!arena_vm_commit(arena, size)) {
+      munmap(arena->data, arena->reserved);
+      arena->data = 0;
+      arena->reserved = 0;
+      return false;
+    }
+
+    return true;
+  }
+
+  if (arena->config.huge_pages && size >= ARENA_HUGE_PAGE_SIZE) {
+    int64_t mapped = ARENA_ALIGN_UP(size, ARENA_HUGE_PAGE_SIZE);
+    arena->data = arena_map_aligned(mapped, ARENA_HUGE_PAGE_SIZE,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS);
+
+    if (arena->data != 0) {
+      arena->reserved = mapped;
+      arena->committed = mapped;
+      arena->backing = ARENA_BACKING_MMAP;
+      arena_request_huge_pages(arena, arena->data, mapped);
+      arena_prefault(arena, arena->data, mapped);
+      return true;
+    }
+  }
+
+  arena->data = calloc(1, size);
+  if (!arena->data)
+    return false;
+
+  arena->backing = ARENA_BACKING_HEAP;
+  arena_prefault(arena, arena->data, size);
+  return true;
+}
+
+static void arena_free_data(Arena *arena) {
+  if (arena->data != 0) {
+    if (arena->backing & ARENA_BACKING_MMAP) {
+      munmap(arena->data, arena->reserved);
+    } else {
+      free(arena->data);
+    }
+  }
+
+  arena->data = 0;
+  arena->reserved = 0;
+  arena->committed = 0;
+  arena->backing = 0;
+}
+
+static void arena_avail_push(Arena *root, Arena *page) {
+  if (!root || !page || page->in_avail)
+    return;
+
+  page->avail_prev = 0;
+  page->avail_next = root->avail;
+
+  if (root->avail != 0)
+    root->avail->avail_prev = page;
+
+  root->avail = page;
+  page->in_avail = true;
+}
+
+static void arena_avail_remove(Arena *root, Arena *page) {
+  if (!root || !page || !page->in_avail)
+    return;
+
+  if (page->avail_prev != 0) {
+    page->avail_prev->avail_next = page->avail_next;
+  } else {
+    root->avail = page->avail_next;
+  }
+
+  if (page->avail_next != 0)
+    page->avail_next->avail_prev = page->avail_prev;
+
+  page->avail_next = 0;
+  page->avail_prev = 0;
+  page->in_avail = false;
+}
+
+static void arena_empty_push(Arena *root, Arena *page) {
+  if (!root || !page || page->in_empty || page == root)
+    return;
+
+  page->empty_prev = 0;
+  page->empty_next = root->empty;
+
+  if (root->empty != 0)
+    root->empty->empty_prev = page;
+
+  root->empty = page;
+  page->in_empty = true;
+}
+
+static void arena_empty_remove(Arena *root, Arena *page) {
+  if (!root || !page || !page->in_empty)
+    return;
+
+  if (page->empty_prev != 0) {
+    page->empty_prev->empty_next = page->empty_next;
+  } else {
+    root->empty = page->empty_next;
+  }
+
+  if (page->empty_next != 0)
+    page->empty_next->empty_prev = page->empty_prev;
+
+  page->empty_next = 0;
+  page->empty_prev = 0;
+  page->in_empty = false;
 }
 
 int arena_init(Arena *arena, ArenaConfig cfg) {
@@ -19,492 +393,2070 @@ int arena_init(Arena *arena, ArenaConfig cfg) {
 
   cfg.items_per_page = OR(cfg.items_per_page, ARENA_ITEMS_PER_PAGE);
 
-  if (!cfg.item_size) {
+  if (!cfg.item_size && !cfg.bump) {
     ARENA_WARNING_RETURN(0, stderr, "No item_size provided.\n");
   }
 
   arena->initialized = true;
 
-  cfg.alignment = OR(cfg.alignment, ARENA_ALIGNMENT);
+  cfg.alignment = OR(cfg.alignment, ARENA_ALIGNMENT);
+  cfg.max_items_per_page =
+      MAX(OR(cfg.max_items_per_page, ARENA_MAX_ITEMS_PER_PAGE),
+          cfg.items_per_page);
+
+  if (cfg.bump) {
+    cfg.page_size = OR(cfg.page_size, ARENA_PAGE_SIZE);
+    arena->slot_size = 0;
+    arena->page_size = cfg.page_size;
+  } else {
+    arena->slot_size = ARENA_ALIGN_UP(cfg.item_size, cfg.alignment);
+    arena->page_size = arena->slot_size * cfg.items_per_page;
+  }
+
+  arena->free_next = 0;
+  arena->free_head = -1;
+  arena->live_bits = 0;
+  arena->dirty_bits = 0;
+  arena->bits_length = 0;
+  arena->generations = 0;
+  arena->malloc_length = 0;
+  arena->free_length = 0;
+  arena->pending_length = 0;
+  arena->total_count = 0;
+
+  // cfg.page_size = OR(cfg.page_size, ARENA_PAGE_SIZE);
+  //  cfg.page_size = ARENA_ALIGN_UP(cfg.page_size, cfg.alignment);
+
+  if (!ARENA_IS_POWER_OF_2(cfg.alignment)) {
+    ARENA_WARNING(stderr, "alignment is not power of 2!\n");
+    arena->initialized = false;
+    return 0;
+  }
+
+  if (cfg.items_per_page > ARENA_MAX_SLOTS) {
+    ARENA_WARNING(stderr, "items_per_page is larger than ARENA_MAX_SLOTS.\n");
+    arena->initialized = false;
+    return 0;
+  }
+
+  // virtual_memory pages reallocate free_next while growing, which remote
+  // threads write to.
+  if (cfg.remote_free && cfg.virtual_memory) {
+    ARENA_WARNING(stderr, "remote_free is not supported with virtual_memory.\n");
+    arena->initialized = false;
+    return 0;
+  }
+
+  if (cfg.remote_free && cfg.bump) {
+    ARENA_WARNING(stderr, "remote_free is not supported in bump mode.\n");
+    arena->initialized = false;
+    return 0;
+  }
+
+  arena->config = cfg;
+  arena->next = 0;
+  arena->cursor = 0;
+  arena->tail = 0;
+  arena->avail = 0;
+  arena->avail_next = 0;
+  arena->avail_prev = 0;
+  arena->in_avail = false;
+  arena->empty = 0;
+  arena->empty_next = 0;
+  arena->empty_prev = 0;
+  arena->in_empty = false;
+  arena->defrag_cursor = 0;
+  arena->bytes = 0;
+  arena->high_water_bytes = 0;
+  arena->reuse_count = 0;
+  arena->bump_count = 0;
+  arena->new_page_count = 0;
+  arena->live_length = 0;
+  arena->data = 0;
+  arena->current = 0;
+  arena->size = 0;
+  arena->broken = false;
+  arena->mark_epoch = 0;
+  arena->epoch = 0;
+  arena->marks_length = 0;
+  arena->mark_top = 0;
+  arena->saved_mark = 0;
+
+  atomic_init(&arena->remote_head, 0);
+  atomic_init(&arena->remote_pages, 0);
+  arena->remote_next = 0;
+  arena->owner = pthread_self();
+
+  // every arena is a root until arena_append_page links it into a chain,
+  // set here once as remote threads read it through arena_get_root.
+  arena->is_root = true;
+  arena->root = arena;
+
+  return 1;
+}
+
+int arena_set_owner(Arena *arena) {
+  if (!arena)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  arena->owner = pthread_self();
+  return 1;
+}
+
+// remote_free: marks the slot freed, false when another free got there
+// first.
+static bool arena_claim_slot(Arena *arena, int64_t id) {
+  uint64_t bit = 1ULL << (id & 63);
+  return (atomic_fetch_or_explicit(&arena->freed_bits[id >> 6], bit,
+                                   memory_order_relaxed) &
+          bit) == 0;
+}
+
+static void arena_unclaim_slot(Arena *arena, int64_t id) {
+  atomic_fetch_and_explicit(&arena->freed_bits[id >> 6], ~(1ULL << (id & 63)),
+                            memory_order_relaxed);
+}
+
+static void arena_claim_all(Arena *arena) {
+  for (int64_t w = 0; w < arena->bits_length; w++)
+    atomic_store_explicit(&arena->freed_bits[w], ~0ULL, memory_order_relaxed);
+}
+
+// puts a slot whose object needs no destructor (any more) on the free list.
+static void arena_push_destroyed(Arena *arena, int64_t id) {
+  ARENA_BIT_CLEAR(arena->dirty_bits, id);
+  arena->free_next[id] = arena->free_head;
+  arena->free_head = id;
+  arena->free_length++;
+}
+
+// returns true when the caller has to destroy the object (under
+// ARENA_DESTROY_EAGER) and then pass the slot to arena_push_destroyed.
+static bool arena_push_free(Arena *arena, int64_t id, bool dirty) {
+  if (arena->freed_bits != 0)
+    arena_claim_slot(arena, id);
+
+  ARENA_BIT_CLEAR(arena->live_bits, id);
+  arena->generations[id]++;
+  arena->live_length--;
+
+  if (dirty && arena->config.destroy_policy == ARENA_DESTROY_EAGER)
+    return true;
+
+  // stays dirty and off the free list until arena_collect_page.
+  if (dirty && arena->config.destroy_policy == ARENA_DESTROY_DEFERRED) {
+    arena->pending_length++;
+    return false;
+  }
+
+  if (dirty) {
+    arena->free_next[id] = arena->free_head;
+    arena->free_head = id;
+    arena->free_length++;
+    return false;
+  }
+
+  arena_push_destroyed(arena, id);
+  return false;
+}
+
+// destroys the objects of slots freed under ARENA_DESTROY_EAGER, then puts
+// the slots on the free list.
+static void arena_destroy_batch(Arena *arena, void **items, int64_t *n) {
+  arena_destroy_items(arena, items, *n);
+
+  for (int64_t i = 0; i < *n; i++)
+    arena_push_destroyed(
+        arena, ((char *)items[i] - (char *)arena->data) / arena->slot_size);
+
+  *n = 0;
+}
+
+// destroys the pending slots of the page in one batch and puts them on the
+// free list.
+static int64_t arena_collect_page(Arena *arena) {
+  if (arena->pending_length <= 0)
+    return 0;
+
+  int64_t count = arena_destroy_range(arena, 0, arena->malloc_length, false);
+
+  for (int64_t w = 0; w < arena->bits_length; w++) {
+    uint64_t pending = arena->dirty_bits[w] & ~arena->live_bits[w];
+    arena->dirty_bits[w] &= arena->live_bits[w];
+
+    while (pending != 0) {
+      int64_t id = (w << 6) + __builtin_ctzll(pending);
+      pending &= pending - 1;
+
+      arena->free_next[id] = arena->free_head;
+      arena->free_head = id;
+      arena->free_length++;
+    }
+  }
+
+  arena->pending_length = 0;
+  return count;
+}
+
+// page bookkeeping after `count` slots were freed with arena_push_free.
+static void arena_page_freed(Arena *arena, int64_t count) {
+  if (count <= 0)
+    return;
+
+  Arena *root = arena_get_root(arena);
+
+  if (arena->live_length == 0)
+    arena_empty_push(root, arena);
+
+  if (arena->free_length <= 0)
+    return;
+
+  // move the page to the front, so the slot freed last is reused first.
+  arena_avail_remove(root, arena);
+  arena_avail_push(root, arena);
+}
+
+static void arena_free_slot(Arena *arena, int64_t id, bool dirty) {
+  if (arena_push_free(arena, id, dirty)) {
+    void *item = arena_slot_ptr(arena, id);
+    int64_t n = 1;
+    arena_destroy_batch(arena, &item, &n);
+  }
+
+  arena_page_freed(arena, 1);
+}
+
+// remote_head entries are slot + 1, tagged when the slot holds no object.
+#define ARENA_REMOTE_CLEAN (1LL << 30)
+
+static void arena_remote_free(Arena *root, Arena *arena, int64_t id,
+                              bool dirty) {
+  int64_t entry = (id + 1) | (dirty ? 0 : ARENA_REMOTE_CLEAN);
+  int64_t head = atomic_load_explicit(&arena->remote_head, memory_order_relaxed);
+
+  // acq_rel: the owner read remote_next before emptying the head, that read
+  // has to happen before this producer rewrites it below.
+  do {
+    arena->free_next[id] = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &arena->remote_head, &head, entry, memory_order_acq_rel,
+      memory_order_relaxed));
+
+  if (head != 0)
+    return;
+
+  // first pending slot on this page, tell the owner about the page.
+  Arena *pages = atomic_load_explicit(&root->remote_pages, memory_order_relaxed);
+
+  do {
+    arena->remote_next = pages;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &root->remote_pages, &pages, arena, memory_order_release,
+      memory_order_relaxed));
+}
+
+static void arena_remote_drain(Arena *root) {
+  Arena *page =
+      atomic_exchange_explicit(&root->remote_pages, 0, memory_order_acquire);
+
+  while (page != 0) {
+    // read before taking the slots, a producer may push the page again
+    // once its head is empty.
+    Arena *next = page->remote_next;
+    int64_t entry =
+        atomic_exchange_explicit(&page->remote_head, 0, memory_order_acq_rel);
+    int64_t count = 0;
+    void *batch[ARENA_DESTROY_BATCH];
+    int64_t n = 0;
+
+    while (entry != 0) {
+      int64_t id = (entry & ~ARENA_REMOTE_CLEAN) - 1;
+      bool dirty = (entry & ARENA_REMOTE_CLEAN) == 0;
+      entry = page->free_next[id];
+
+      if (ARENA_BIT_TEST(page->live_bits, id)) {
+        if (arena_push_free(page, id, dirty))
+          batch[n++] = arena_slot_ptr(page, id);
+        if (n == ARENA_DESTROY_BATCH)
+          arena_destroy_batch(page, batch, &n);
+        count++;
+      }
+    }
+
+    arena_destroy_batch(page, batch, &n);
+    arena_page_freed(page, count);
+    page = next;
+  }
+}
+
+static int arena_free_private(ArenaRef ref, bool dirty) {
+
+  Arena *arena = ref.arena;
+
+  if (!arena)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+  if (arena->broken)
+    ARENA_WARNING_RETURN(0, stderr, "This arena is broken.\n");
+
+  if (arena->live_bits == 0)
+    ARENA_WARNING_RETURN(0, stderr, "Page has no slots.\n");
+
+  if (ref.id >= arena->config.items_per_page || ref.id <= -1)
+    ARENA_WARNING_RETURN(0, stderr, "ref.id is invalid.\n");
+
+  Arena *root = arena_get_root(arena);
+
+  // the live bits belong to the owner, other threads only claim the slot.
+  if (arena->freed_bits != 0 && !arena_claim_slot(arena, ref.id))
+    ARENA_WARNING_RETURN(0, stderr, "ref is not in use.\n");
+
+  if (root && root->config.remote_free &&
+      !pthread_equal(root->owner, pthread_self())) {
+    arena_remote_free(root, arena, ref.id, dirty);
+    return 1;
+  }
+
+  if (!ARENA_BIT_TEST(arena->live_bits, ref.id))
+    ARENA_WARNING_RETURN(0, stderr, "ref is not in use.\n");
+
+  arena_free_slot(arena, ref.id, dirty);
+
+  // arena_ArenaRef_buffer_push(&ref.arena->freed_memory, ref);
+  return 1;
+}
+
+int arena_free(ArenaRef ref) {
+  ARENA_PROFILE_BEGIN(profile, 0);
+  int ok = arena_free_private(ref, true);
+  ARENA_PROFILE_END(profile, ARENA_PROFILE_FREE, 0, ok);
+  return ok;
+}
+
+// validates a page once for a batch of frees, returns -1 when the slots
+// have to go through the remote queue.
+static int arena_free_check_page(Arena *arena) {
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+  if (arena->broken)
+    ARENA_WARNING_RETURN(0, stderr, "This arena is broken.\n");
+  if (arena->live_bits == 0)
+    ARENA_WARNING_RETURN(0, stderr, "Page has no slots.\n");
+
+  Arena *root = arena_get_root(arena);
+
+  if (root && root->config.remote_free &&
+      !pthread_equal(root->owner, pthread_self()))
+    return -1;
+
+  return 1;
+}
+
+int64_t arena_free_n(ArenaRef *refs, int64_t n) {
+  if (!refs || n <= 0)
+    return 0;
+
+  ARENA_PROFILE_BEGIN(profile, 0);
+
+  int64_t freed = 0;
+  int64_t i = 0;
+
+  while (i < n) {
+    Arena *page = refs[i].arena;
+    int64_t end = i + 1;
+
+    while (end < n && refs[end].arena == page)
+      end++;
+
+    int check = page ? arena_free_check_page(page) : 0;
+    int64_t count = 0;
+    void *batch[ARENA_DESTROY_BATCH];
+    int64_t batched = 0;
+
+    for (; check != 0 && i < end; i++) {
+      int64_t id = refs[i].id;
+
+      if (id < 0 || id >= page->config.items_per_page)
+        continue;
+      if (page->freed_bits != 0 && !arena_claim_slot(page, id))
+        continue;
+
+      if (check < 0) {
+        arena_remote_free(arena_get_root(page), page, id, true);
+        freed++;
+        continue;
+      }
+
+      if (!ARENA_BIT_TEST(page->live_bits, id))
+        continue;
+
+      if (arena_push_free(page, id, true))
+        batch[batched++] = arena_slot_ptr(page, id);
+      if (batched == ARENA_DESTROY_BATCH)
+        arena_destroy_batch(page, batch, &batched);
+      count++;
+    }
+
+    arena_destroy_batch(page, batch, &batched);
+    arena_page_freed(page, count);
+    freed += count;
+    i = end;
+  }
+
+  ARENA_PROFILE_END(profile, ARENA_PROFILE_FREE, 0, freed);
+  return freed;
+}
+
+int64_t arena_free_if(Arena *arena, ArenaPredicateFunction predicate,
+                      void *user_ptr) {
+  if (!arena || !predicate)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  int64_t freed = 0;
+
+  for (Arena *page = arena; page != 0; page = page->next) {
+    if (page->live_bits == 0 || page->broken)
+      continue;
+
+    int64_t count = 0;
+    void *batch[ARENA_DESTROY_BATCH];
+    int64_t n = 0;
+
+    for (int64_t w = 0; w < page->bits_length; w++) {
+      uint64_t live = page->live_bits[w];
+
+      while (live != 0) {
+        int64_t id = (w << 6) + __builtin_ctzll(live);
+        live &= live - 1;
+
+        if (predicate(user_ptr, arena_slot_ptr(page, id))) {
+          // another thread may have freed it already.
+          if (page->freed_bits != 0 && !arena_claim_slot(page, id))
+            continue;
+          if (arena_push_free(page, id, true))
+            batch[n++] = arena_slot_ptr(page, id);
+          if (n == ARENA_DESTROY_BATCH)
+            arena_destroy_batch(page, batch, &n);
+          count++;
+        }
+      }
+    }
+
+    arena_destroy_batch(page, batch, &n);
+    arena_page_freed(page, count);
+    freed += count;
+  }
+
+  return freed;
+}
+
+int arena_release(ArenaRef ref) { return arena_free_private(ref, false); }
+
+// makes sure the page has its data and slot metadata.
+static bool arena_prepare_page(Arena *arena) {
+  if (!arena)
+    ARENA_WARNING_RETURN(false, stderr, "arena == null.\n");
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(false, stderr, "Arena not initialized.\n");
+
+  bool bump = arena->config.bump;
+  int64_t size = bump ? arena->page_size : arena->config.item_size;
+
+  if (size <= 0)
+    ARENA_WARNING_RETURN(false, stderr, "Invalid allocation size of %ld bytes.\n",
+			 size);
+  if (arena->broken)
+    ARENA_WARNING_RETURN(false, stderr, "This arena is broken.\n");
+
+  if (arena->data != 0 && (bump || arena->live_bits != 0))
+    return true;
+
+  // int64_t og_size = size;
+  size = ARENA_ALIGN_UP(size, arena->config.alignment);
+
+  int64_t data_size = size > arena->page_size ? size : arena->page_size;
+  int64_t held = arena->data ? arena->size : 0;
+
+  if (!arena->data && arena->config.page_pool && !arena->config.virtual_memory)
+    arena_page_pool_take(arena->config.page_pool, arena);
+
+  if (!arena->data) {
+    arena_alloc_data(arena, data_size);
+    arena->size = data_size;
+  }
+
+  arena->size = MAX(arena->size, data_size);
+
+  if (!arena->data) {
+    arena->broken = true;
+    ARENA_WARNING_RETURN(false, stderr,
+			 "Arena has failed to allocate more memory.\n");
+  }
+
+  arena_account_bytes(arena, arena->size - held);
+
+  if (!bump && !arena->live_bits) {
+    arena->free_next =
+	(int32_t *)calloc(arena->config.items_per_page, sizeof(int32_t));
+    arena->free_head = -1;
+    arena->bits_length = ARENA_BITS_WORDS(arena->config.items_per_page);
+    arena->live_bits = (uint64_t *)calloc(arena->bits_length, sizeof(uint64_t));
+    arena->dirty_bits = (uint64_t *)calloc(arena->bits_length, sizeof(uint64_t));
+    arena->generations =
+        (uint16_t *)calloc(arena->config.items_per_page, sizeof(uint16_t));
+
+    if (!arena->free_next || !arena->live_bits || !arena->dirty_bits ||
+        !arena->generations) {
+      arena->broken = true;
+      ARENA_WARNING_RETURN(false, stderr, "Failed to allocate slot metadata.\n");
+    }
+  }
+
+  if (!bump && arena->config.remote_free && !arena->freed_bits) {
+    arena->freed_bits = calloc(arena->bits_length, sizeof(uint64_t));
+
+    if (!arena->freed_bits) {
+      arena->broken = true;
+      ARENA_WARNING_RETURN(false, stderr, "Failed to allocate slot metadata.\n");
+    }
+  }
+
+  if (arena->freed_bits != 0 && arena->malloc_length == 0)
+    arena_claim_all(arena);
+
+  return true;
+}
+
+// number of slots that can still be bump allocated from the page.
+static int64_t arena_page_room(Arena *arena) {
+  return MIN(arena->config.items_per_page - arena->malloc_length,
+             (arena->size - arena->current) / arena->slot_size);
+}
+
+static void arena_output_ref(Arena *arena, int64_t id, int64_t i, void **ptrs,
+                             ArenaRef *refs) {
+  if (ptrs != 0)
+    ptrs[i] = arena_slot_ptr(arena, id);
+
+  if (refs != 0)
+    refs[i] = arena_make_ref(arena, id);
+}
+
+// pops the most recently freed slot of the page, or -1.
+static int64_t arena_reuse_(Arena *arena) {
+  int64_t id = arena->free_head;
+
+  if (id < 0)
+    return -1;
+
+  arena->free_head = arena->free_next[id];
+
+  if (ARENA_BIT_TEST(arena->dirty_bits, id)) {
+    void *ptr = arena_slot_ptr(arena, id);
+    arena_destroy_items(arena, &ptr, 1);
+  }
+
+  ARENA_BIT_SET(arena->live_bits, id);
+  ARENA_BIT_SET(arena->dirty_bits, id);
+  arena->free_length = MAX(0, arena->free_length - 1);
+
+  if (arena->freed_bits != 0)
+    arena_unclaim_slot(arena, id);
+
+  arena_mark_reuse(arena, id);
+
+  if (arena->live_length++ == 0 && arena->in_empty)
+    arena_empty_remove(arena_get_root(arena), arena);
+  return id;
+}
+
+static bool arena_mark_push(Arena *root, ArenaMarkEntry entry) {
+  if (root->marks_length >= root->marks_capacity) {
+    int64_t capacity = MAX(16, root->marks_capacity * 2);
+    ArenaMarkEntry *marks = arena_grow_array(
+        root->marks, root->marks_capacity, capacity, sizeof(ArenaMarkEntry));
+    if (!marks)
+      return false;
+
+    root->marks = marks;
+    root->marks_capacity = capacity;
+  }
+
+  root->marks[root->marks_length++] = entry;
+  return true;
+}
+
+// logs where a page written before the newest mark stands, the first time
+// it is bump allocated from after it.
+static void arena_mark_save(Arena *page) {
+  Arena *root = arena_get_root(page);
+
+  if (root->mark_top == 0 || page->malloc_length == 0 ||
+      page->epoch >= root->mark_top || page->saved_mark == root->mark_top)
+    return;
+
+  ArenaMarkEntry entry = {.page = page,
+                          .current = page->current,
+                          .malloc_length = page->malloc_length,
+                          .slot = -1,
+                          .mark = root->mark_top};
+
+  // a rewind could not restore the page, so refuse it instead.
+  if (!arena_mark_push(root, entry)) {
+    root->marks_length = 0;
+    root->mark_top = 0;
+    return;
+  }
+
+  page->saved_mark = root->mark_top;
+}
+
+// logs a slot recycled from the free list while a mark is taken.
+static void arena_mark_reuse(Arena *page, int64_t id) {
+  Arena *root = arena_get_root(page);
+
+  if (root->mark_top == 0)
+    return;
+
+  ArenaMarkEntry entry = {.page = page, .slot = id, .mark = root->mark_top};
+
+  if (!arena_mark_push(root, entry)) {
+    root->marks_length = 0;
+    root->mark_top = 0;
+  }
+}
+
+// bump allocates up to n consecutive slots from the page, writing them to
+// ptrs / refs starting at offset.
+static int64_t arena_bump_n_(Arena *arena, int64_t n, void **ptrs,
+                             ArenaRef *refs, int64_t offset) {
+  int64_t count = MIN(n, arena_page_room(arena));
+
+  if (count > 0)
+    arena_mark_save(arena);
+
+  for (int64_t i = 0; i < count; i++) {
+    int64_t id = arena->malloc_length;
+
+    if (arena->malloc_length == 0)
+      arena->epoch = arena_get_root(arena)->mark_epoch;
+
+    arena->current += arena->slot_size;
+    arena->malloc_length++;
+
+    ARENA_BIT_SET(arena->live_bits, id);
+    ARENA_BIT_SET(arena->dirty_bits, id);
+
+    if (arena->freed_bits != 0)
+      arena_unclaim_slot(arena, id);
+
+    arena_output_ref(arena, id, offset + i, ptrs, refs);
+  }
+
+  arena->live_length += count;
+
+  if (count > 0 && arena->in_empty)
+    arena_empty_remove(arena_get_root(arena), arena);
+  return count;
+}
+
+static bool arena_page_table_set(Arena *root, int64_t index, Arena *page) {
+  if (index >= root->page_table_length) {
+    int64_t length = MAX(16, root->page_table_length * 2);
+    while (length <= index)
+      length *= 2;
+
+    Arena **table = arena_grow_array(root->page_table, root->page_table_length,
+                                     length, sizeof(Arena *));
+    if (table)
+      root->page_table = table;
+
+    int64_t *free_indices = arena_grow_array(
+        root->free_indices, root->page_table_length, length, sizeof(int64_t));
+    if (free_indices)
+      root->free_indices = free_indices;
+
+    uint16_t *generations =
+        arena_grow_array(root->index_generations, root->page_table_length,
+                         length, sizeof(uint16_t));
+    if (generations)
+      root->index_generations = generations;
+
+    if (!table || !free_indices || !generations)
+      return false;
+
+    root->page_table_length = length;
+  }
+
+  root->page_table[index] = page;
+  return true;
+}
+
+static Arena *arena_append_page(Arena *root, int64_t items) {
+  ArenaConfig cfg = root->config;
+  cfg.items_per_page = items;
+
+  Arena *page = cfg.page_pool ? arena_page_pool_new_page(cfg.page_pool)
+                              : NEW(Arena);
+  if (!page) {
+    root->broken = true;
+    ARENA_WARNING_RETURN(0, stderr, "Failed to allocate page.\n");
+  }
+
+  // a page refused for its size leaves the arena usable.
+  if (!arena_init(page, cfg)) {
+    free(page);
+    ARENA_WARNING_RETURN(0, stderr, "Failed to initialize page.\n");
+  }
+
+  page->is_root = false;
+  page->root = root;
+
+  // released indices first, so the table stays as large as the chain.
+  if (root->free_indices_length > 0) {
+    page->index = root->free_indices[--root->free_indices_length];
+    page->generation_base = root->index_generations[page->index];
+  } else {
+    page->index = ++root->last_index;
+  }
+
+  if (!arena_page_table_set(root, page->index, page)) {
+    free(page);
+    root->broken = true;
+    ARENA_WARNING_RETURN(0, stderr, "Failed to allocate page table.\n");
+  }
+
+  page->prev = root->tail;
+  root->tail->next = page;
+  root->tail = page;
+  root->pages++;
+  root->new_page_count++;
+  return page;
+}
+
+// moves the cursor to a page with room, growing the arena if needed.
+static bool arena_advance_cursor(Arena *root) {
+  Arena *page = root->cursor;
+
+  if (page->config.virtual_memory) {
+    if (!arena_vm_grow(page))
+      ARENA_WARNING_RETURN(false, stderr, "Reserved memory exhausted.\n");
+    return true;
+  }
+
+  if (page->next == 0 &&
+      !arena_append_page(root, arena_next_page_items(
+                                   root->config, page->config.items_per_page)))
+    return false;
+
+  root->cursor = page->next;
+  return true;
+}
+
+static bool arena_begin(Arena *arena) {
+  if (!arena)
+    ARENA_WARNING_RETURN(false, stderr, "arena == null.\n");
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(false, stderr, "Arena not initialized.\n");
+  if (arena->broken)
+    ARENA_WARNING_RETURN(false, stderr, "This arena is broken.\n");
+
+  int64_t size = arena->config.item_size;
+
+  if (size <= 0 && !arena->config.bump)
+    ARENA_WARNING_RETURN(false, stderr, "Invalid allocation size of %ld bytes.\n",
+			 size);
+
+  if (arena->config.remote_free &&
+      atomic_load_explicit(&arena->remote_pages, memory_order_relaxed) != 0)
+    arena_remote_drain(arena);
+
+  if (arena->cursor == 0)
+    arena->cursor = arena;
+  if (arena->tail == 0)
+    arena->tail = arena;
+
+  if (arena->page_table == 0) {
+    if (arena->config.page_pool)
+      arena_page_pool_take_table(arena->config.page_pool, arena);
+
+    if (!arena_page_table_set(arena, 0, arena))
+      ARENA_WARNING_RETURN(false, stderr, "Failed to allocate page table.\n");
+  }
+
+  return true;
+}
+
+static int64_t arena_malloc_contiguous(Arena *arena, int64_t n, void **ptrs,
+                                       ArenaRef *refs) {
+  Arena *page = arena->cursor;
+
+  if (!arena_prepare_page(page))
+    return 0;
+
+  if (page->config.virtual_memory) {
+    while (arena_page_room(page) < n) {
+      if (!arena_vm_grow(page))
+        ARENA_WARNING_RETURN(0, stderr, "Reserved memory exhausted.\n");
+    }
+  } else if (arena_page_room(page) < n) {
+    // try the tail before growing, pages in between are left to the cursor.
+    page = arena->tail;
+
+    if (!arena_prepare_page(page))
+      return 0;
+
+    if (arena_page_room(page) < n) {
+      int64_t items =
+          arena_next_page_items(arena->config, page->config.items_per_page);
+
+      page = arena_append_page(arena, MAX(items, n));
+      if (!page || !arena_prepare_page(page))
+        return 0;
+    }
+  }
+
+  return arena_bump_n_(page, n, ptrs, refs, 0);
+}
+
+static int64_t arena_malloc_n_(Arena *arena, int64_t n, void **ptrs,
+                               ArenaRef *refs, int flags) {
+  if (n <= 0)
+    return 0;
+  if (n > ARENA_MAX_SLOTS)
+    ARENA_WARNING_RETURN(0, stderr, "Batch of %ld objects is too large.\n", n);
+  if (!arena_begin(arena))
+    return 0;
+  if (arena->config.bump)
+    ARENA_WARNING_RETURN(0, stderr, "Use arena_malloc_size in bump mode.\n");
+
+  int64_t count = 0;
+
+  if (flags & ARENA_MALLOC_CONTIGUOUS) {
+    count = arena_malloc_contiguous(arena, n, ptrs, refs);
+    arena->total_count += count;
+    arena->bump_count += count;
+    return count;
+  }
+
+  // Pages with freed slots first, so memory is recycled before the arena
+  // grows.
+  while (count < n && arena->avail != 0) {
+    Arena *page = arena->avail;
+    int64_t id = -1;
+
+    while (count < n && (id = arena_reuse_(page)) >= 0) {
+      arena_output_ref(page, id, count, ptrs, refs);
+      count++;
+    }
+
+    if (page->free_length <= 0 || id < 0)
+      arena_avail_remove(arena, page);
+  }
+
+  int64_t reused = count;
+  arena->reuse_count += reused;
+
+  // Then bump allocate from the cursor, moving it forward (and growing the
+  // chain) once the current page is full.
+  while (count < n) {
+    Arena *page = arena->cursor;
+
+    if (!arena_prepare_page(page))
+      break;
+
+    count += arena_bump_n_(page, n - count, ptrs, refs, count);
+
+    if (count < n && !arena_advance_cursor(arena))
+      break;
+  }
+
+  arena->bump_count += count - reused;
+  arena->total_count += count;
+  return count;
+}
+
+int64_t arena_malloc_n(Arena *arena, int64_t n, void **ptrs, ArenaRef *refs,
+                       int flags) {
+  ARENA_PROFILE_BEGIN(profile, arena);
+  int64_t count = arena_malloc_n_(arena, n, ptrs, refs, flags);
+  ARENA_PROFILE_END(profile, ARENA_PROFILE_MALLOC, arena, count);
+  return count;
+}
+
+// carves size bytes out of the page, or returns null when they don't fit.
+static void *arena_bump_size_(Arena *arena, int64_t size, int64_t align) {
+  uintptr_t base = (uintptr_t)arena->data;
+  int64_t start = ARENA_ALIGN_UP(base + arena->current, (uintptr_t)align) - base;
+
+  if (start + size > arena->size)
+    return 0;
+
+  arena_mark_save(arena);
+
+  if (arena->malloc_length == 0)
+    arena->epoch = arena_get_root(arena)->mark_epoch;
+
+  arena->current = start + size;
+  arena->malloc_length++;
+  arena->live_length++;
+  return (char *)arena->data + start;
+}
+
+static void *arena_malloc_size_(Arena *arena, size_t size, size_t align) {
+  if (!arena_begin(arena))
+    return 0;
+  if (!arena->config.bump)
+    ARENA_WARNING_RETURN(0, stderr, "arena_malloc_size needs config.bump.\n");
+
+  align = OR(align, (size_t)arena->config.alignment);
+
+  if (size == 0 || !ARENA_IS_POWER_OF_2(align))
+    ARENA_WARNING_RETURN(0, stderr, "Invalid allocation of %zu bytes aligned to %zu.\n",
+                         size, align);
+
+  Arena *page = arena->cursor;
+  void *ptr = 0;
+
+  if (arena->config.virtual_memory) {
+    // a single page, committed further as it fills up.
+    if (!arena_prepare_page(page))
+      return 0;
+
+    while ((ptr = arena_bump_size_(page, size, align)) == 0) {
+      int64_t needed = page->current + size + align;
+
+      // the last step commits whatever is left of the reservation.
+      if (needed > page->reserved || page->committed == page->reserved ||
+          !arena_vm_commit(page, MIN(MAX(page->committed * 2, needed), page->reserved)))
+        ARENA_WARNING_RETURN(0, stderr, "Reserved memory exhausted.\n");
+      arena_account_bytes(page, page->committed - page->size);
+      page->size = page->committed;
+    }
+  } else if (size > (size_t)arena->config.page_size / 2) {
+    // oversized requests get a page of their own at the tail, the cursor
+    // keeps filling the current page.
+    page = arena_append_page(arena, arena->config.items_per_page);
+    if (!page)
+      return 0;
+
+    page->page_size = ARENA_ALIGN_UP(size + align, (size_t)arena->config.alignment);
+
+    // a failed big request leaves the chain as it was for the small ones.
+    if (!arena_prepare_page(page)) {
+      arena_drop_page(arena, page);
+      return 0;
+    }
+
+    ptr = arena_bump_size_(page, size, align);
+
+    // nothing else goes on the page, so arena_rewind can treat it whole.
+    page->current = page->size;
+  } else {
+    while (true) {
+      if (!arena_prepare_page(page))
+        return 0;
+
+      if ((ptr = arena_bump_size_(page, size, align)) != 0)
+        break;
+
+      // pages past the cursor are empty after a reset, or dedicated ones
+      // that are full and get skipped.
+      if (page->next == 0 &&
+          !arena_append_page(arena, arena->config.items_per_page))
+        return 0;
+
+      page = page->next;
+      arena->cursor = page;
+    }
+  }
+
+  if (ptr == 0)
+    ARENA_WARNING_RETURN(0, stderr, "Failed to allocate memory.\n");
+
+  arena->total_count++;
+  arena->bump_count++;
+  return ptr;
+}
+
+void *arena_malloc_size(Arena *arena, size_t size, size_t align) {
+  ARENA_PROFILE_BEGIN(profile, arena);
+  void *ptr = arena_malloc_size_(arena, size, align);
+  ARENA_PROFILE_END(profile, ARENA_PROFILE_MALLOC, arena, ptr != 0);
+  return ptr;
+}
+
+static void *arena_malloc_(Arena *arena, ArenaRef *user_ref) {
+  void *ptr = 0;
+
+  if (arena_malloc_n_(arena, 1, &ptr, user_ref, 0) != 1 || ptr == 0)
+    ARENA_WARNING_RETURN(0, stderr, "Failed to allocate memory.\n");
+
+  return ptr;
+}
+
+void *arena_malloc(Arena *arena, ArenaRef *user_ref) {
+  ARENA_PROFILE_BEGIN(profile, arena);
+  void *ptr = arena_malloc_(arena, user_ref);
+  ARENA_PROFILE_END(profile, ARENA_PROFILE_MALLOC, arena, ptr != 0);
+  return ptr;
+}
+
+ArenaHandle arena_handle_from_ref(ArenaRef ref) {
+  Arena *page = ref.arena;
+
+  if (!page || !page->generations || ref.id < 0 ||
+      ref.id >= page->config.items_per_page)
+    return ARENA_HANDLE_NULL;
+
+  if (ref.id >= (1LL << ARENA_HANDLE_SLOT_BITS) ||
+      page->index + 1 >= (1LL << ARENA_HANDLE_PAGE_BITS))
+    ARENA_WARNING_RETURN(ARENA_HANDLE_NULL, stderr,
+                         "Slot cannot be encoded in a handle.\n");
+
+  uint64_t generation =
+      (uint16_t)(page->generations[ref.id] + page->generation_base);
+
+  return (generation << (ARENA_HANDLE_SLOT_BITS + ARENA_HANDLE_PAGE_BITS)) |
+         ((uint64_t)(page->index + 1) << ARENA_HANDLE_SLOT_BITS) |
+         (uint64_t)ref.id;
+}
+
+// the page and slot of a handle that is still valid.
+static Arena *arena_handle_resolve(Arena *arena, ArenaHandle handle,
+                                   int64_t *slot) {
+  if (!arena || handle == ARENA_HANDLE_NULL || !arena->page_table)
+    return 0;
+
+  int64_t id = handle & ((1ULL << ARENA_HANDLE_SLOT_BITS) - 1);
+  int64_t index = ((handle >> ARENA_HANDLE_SLOT_BITS) &
+                   ((1ULL << ARENA_HANDLE_PAGE_BITS) - 1)) - 1;
+  uint16_t generation =
+      handle >> (ARENA_HANDLE_SLOT_BITS + ARENA_HANDLE_PAGE_BITS);
+
+  if (index < 0 || index >= arena->page_table_length)
+    return 0;
+
+  Arena *page = arena->page_table[index];
+
+  if (!page || id >= page->malloc_length ||
+      (uint16_t)(page->generations[id] + page->generation_base) != generation ||
+      !ARENA_BIT_TEST(page->live_bits, id))
+    return 0;
+
+  *slot = id;
+  return page;
+}
+
+void *arena_malloc_handle(Arena *arena, ArenaHandle *handle) {
+  ArenaRef ref = {0};
+
+  ARENA_PROFILE_BEGIN(profile, arena);
+  void *ptr = arena_malloc_(arena, &ref);
+  ARENA_PROFILE_END(profile, ARENA_PROFILE_MALLOC, arena, ptr != 0);
+
+  if (handle != 0)
+    *handle = ptr ? arena_handle_from_ref(ref) : ARENA_HANDLE_NULL;
+
+  return ptr;
+}
+
+void *arena_get(Arena *arena, ArenaHandle handle) {
+  int64_t id = 0;
+  Arena *page = arena_handle_resolve(arena, handle, &id);
+
+  if (!page)
+    return 0;
+
+  return arena_slot_ptr(page, id);
+}
+
+int arena_free_handle(Arena *arena, ArenaHandle handle) {
+  int64_t id = 0;
+  Arena *page = arena_handle_resolve(arena, handle, &id);
+
+  if (!page)
+    ARENA_WARNING_RETURN(0, stderr, "Stale or invalid handle.\n");
+
+  ARENA_PROFILE_BEGIN(profile, 0);
+  int ok = arena_free_private((ArenaRef){.arena = page, .id = id}, true);
+  ARENA_PROFILE_END(profile, ARENA_PROFILE_FREE, 0, ok);
+  return ok;
+}
+
+int arena_unuse_all(Arena *arena) {
+  if (!arena || arena->initialized == false || arena->live_bits == 0) return 0;
+  
+  int64_t i = arena_bits_next(arena->live_bits, 0, arena->malloc_length);
+  while (i >= 0) {
+    arena_free_private(arena_make_ref(arena, i), true);
+    i = arena_bits_next(arena->live_bits, i + 1, arena->malloc_length);
+  }
+
+  return 1;
+}
+
+int arena_clear(Arena *arena) {
+  if (!arena)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  // objects that were freed but never reused still need their destructor.
+  if (arena->live_bits != 0)
+    arena_destroy_range(arena, 0, arena->bits_length * 64, false);
+  arena->pending_length = 0;
+  arena->live_length = 0;
+
+  if (arena->live_bits != 0) {
+    free(arena->live_bits);
+    arena->live_bits = 0;
+  }
+
+  if (arena->dirty_bits != 0) {
+    free(arena->dirty_bits);
+    arena->dirty_bits = 0;
+  }
+  arena->bits_length = 0;
+
+  if (arena->generations != 0) {
+    free(arena->generations);
+    arena->generations = 0;
+  }
+
+  if (arena->freed_bits != 0) {
+    free((void *)arena->freed_bits);
+    arena->freed_bits = 0;
+  }
+
+  if (arena->free_next != 0) {
+    free(arena->free_next);
+    arena->free_next = 0;
+  }
+  arena->free_head = -1;
+
+  // arena_ArenaRef_buffer_clear(&arena->freed_memory);
+
+  arena_free_data(arena);
+
+  arena->malloc_length = 0;
+  arena->free_length = 0;
+  arena->total_count = 0;
+
+  arena->size = 0;
+  arena->current = 0;
+  arena->broken = false;
+  arena->pages = 0;
+  return 1;
+}
+
+// hands a detached, reset page to config.page_pool, or frees it.
+static void arena_release_page(Arena *page) {
+  if (page->config.page_pool &&
+      arena_page_pool_put(page->config.page_pool, page, true))
+    return;
+
+  arena_clear(page);
+  free(page);
+}
+
+// takes a page out of the chain and every root list that refers to it.
+static void arena_unlink_page(Arena *root, Arena *page) {
+  Arena *prev = page->prev;
+  Arena *next = page->next;
+
+  if (prev && prev->next == page)
+    prev->next = next;
+  if (next && next->prev == page)
+    next->prev = prev;
+
+  arena_avail_remove(root, page);
+  arena_empty_remove(root, page);
+
+  if (root->defrag_cursor == page)
+    root->defrag_cursor = next;
+
+  if (page->data != 0)
+    arena_account_bytes(page, -page->size);
+
+  if (page->index > 0 && page->index < root->page_table_length &&
+      root->page_table[page->index] == page) {
+    uint16_t highest = 0;
+
+    for (int64_t i = 0; page->generations && i < page->config.items_per_page;
+         i++)
+      highest = MAX(highest, page->generations[i]);
+
+    // past every generation handed out on the page.
+    root->page_table[page->index] = 0;
+    root->index_generations[page->index] =
+        page->generation_base + highest + 1;
+    root->free_indices[root->free_indices_length++] = page->index;
+  }
+
+  if (root->cursor == page)
+    root->cursor = prev;
+  if (root->tail == page)
+    root->tail = prev;
+
+  // marks and log entries may point at the page.
+  root->marks_length = 0;
+  root->mark_top = 0;
+
+  // detach before resetting, arena_reset walks the rest of the chain.
+  page->next = 0;
+  page->prev = 0;
+
+  root->pages = MAX(root->pages - 1, 0);
+}
+
+// takes back a page arena_append_page just added, before anything was
+// allocated from it, so no mark refers to it.
+static void arena_drop_page(Arena *root, Arena *page) {
+  int64_t marks_length = root->marks_length;
+  uint64_t mark_top = root->mark_top;
+
+  arena_unlink_page(root, page);
+  arena_release_page(page);
+
+  root->marks_length = marks_length;
+  root->mark_top = mark_top;
+}
+
+static int arena_destroy_private(Arena *arena, bool should_free) {
+  if (!arena)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  arena_reset_(arena);
+
+  Arena *page = arena->next;
+  arena->next = 0;
+
+  // the root struct belongs to the caller, only its memory is pooled.
+  if (arena->config.page_pool)
+    arena_page_pool_put(arena->config.page_pool, arena, false);
+  arena_clear(arena);
+
+  while (page != 0) {
+    Arena *next = page->next;
+    page->next = 0;
+    arena_release_page(page);
+    page = next;
+  }
+
+  if (arena->is_root) {
+    arena->cursor = arena;
+    arena->tail = arena;
+    arena->avail = 0;
+    arena->bytes = 0;
+
+    // a pooled root leaves its page table to the next one.
+    if (arena->config.page_pool)
+      arena_page_pool_put_table(arena->config.page_pool, arena);
+
+    free(arena->page_table);
+    arena->page_table = 0;
+    free(arena->free_indices);
+    arena->free_indices = 0;
+    free(arena->index_generations);
+    arena->index_generations = 0;
+    free(arena->marks);
+    arena->marks = 0;
+    arena->marks_capacity = 0;
+    arena->page_table_length = 0;
+    arena->free_indices_length = 0;
+    arena->last_index = 0;
+  }
+
+  if (should_free) {
+    free(arena);
+    arena = 0;
+  }
+
+  return 1;
+}
+
+int arena_destroy(Arena *arena) {
+  if (!arena)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  return arena_destroy_private(arena, false);
+}
+
+bool arena_is_broken(Arena arena) {
+  if (!arena.initialized)
+    return false;
+  return arena.broken;
+}
+
+int arena_iterate(Arena *arena, ArenaIterator *it) {
+  if (!arena || !it)
+    return 0;
+
+  Arena *page = it->arena != 0 ? it->arena : arena;
+
+  // resume after the slot returned last time.
+  int64_t start = it->ref.ptr != 0 ? it->ref.id + 1 : it->ref.id;
+
+  while (page != 0) {
+    int64_t i = arena_bits_next(page->dirty_bits, start, page->malloc_length);
+
+    if (i >= 0) {
+      it->ref = arena_make_ref(page, i);
+      it->arena = page;
+      return 1;
+    }
+
+    page = page->next;
+    start = 0;
+  }
+
+  return 0;
+}
+
+int64_t arena_for_each(Arena *arena, ArenaIterFunction fn, void *user_ptr) {
+  if (!arena || !fn)
+    return 0;
+
+  int64_t visited = 0;
+
+  for (Arena *page = arena; page != 0; page = page->next) {
+    if (page->live_bits == 0 || page->live_length == 0)
+      continue;
+
+    char *data = (char *)page->data;
+    int64_t size = page->slot_size;
+    int64_t words = ARENA_BITS_WORDS(page->malloc_length);
+
+    for (int64_t w = 0; w < words; w++) {
+      uint64_t live = page->live_bits[w];
+
+      while (live != 0) {
+        int64_t id = (w << 6) + __builtin_ctzll(live);
+        live &= live - 1;
+
+        fn(user_ptr, data + id * size);
+        visited++;
+      }
+    }
+  }
+
+  return visited;
+}
+
+int64_t arena_for_each_span(Arena *arena, ArenaSpanFunction fn,
+                            void *user_ptr) {
+  if (!arena || !fn)
+    return 0;
+
+  int64_t visited = 0;
+
+  for (Arena *page = arena; page != 0; page = page->next) {
+    if (page->live_bits == 0 || page->live_length == 0)
+      continue;
+
+    int64_t words = ARENA_BITS_WORDS(page->malloc_length);
+
+    for (int64_t w = 0; w < words; w++) {
+      uint64_t live = page->live_bits[w];
+
+      if (live == 0)
+        continue;
+
+      ArenaSpan span = {.base = arena_slot_ptr(page, w << 6),
+                        .stride = page->slot_size,
+                        .count = MIN(64, page->malloc_length - (w << 6)),
+                        .live_mask = live};
+      fn(user_ptr, span);
+      visited++;
+    }
+  }
+
+  return visited;
+}
+
+int64_t arena_get_allocation_count(Arena arena) {
+  if (!arena.initialized)
+    return 0;
+  if (arena.data == 0)
+    return 0;
+  return arena.total_count;
+}
+
+int arena_get_stats(Arena *arena, ArenaStats *stats) {
+  if (!arena || !stats)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  memset(stats, 0, sizeof(ArenaStats));
+
+  for (Arena *page = arena; page != 0; page = page->next) {
+    stats->pages++;
+    stats->live += page->live_length;
+    stats->backing |= page->backing;
+
+    if (page->data != 0)
+      stats->bytes_reserved += page->size;
+
+    if (page->config.bump) {
+      stats->bytes_used += page->current;
+      continue;
+    }
+
+    // counted from the slots rather than free_length, which is clamped.
+    stats->capacity += page->config.items_per_page;
+    stats->carved += page->malloc_length;
+    stats->pending += page->pending_length;
+    stats->free +=
+        page->malloc_length - page->live_length - page->pending_length;
+    stats->bytes_used += page->live_length * page->slot_size;
+  }
+
+  if (stats->carved > 0)
+    stats->fragmentation =
+        (double)(stats->carved - stats->live) / (double)stats->carved;
+
+  stats->high_water_bytes = MAX(arena->high_water_bytes, stats->bytes_reserved);
+  stats->reuse_count = arena->reuse_count;
+  stats->bump_count = arena->bump_count;
+  stats->new_page_count = arena->new_page_count;
+  return 1;
+}
+
+static void arena_reset_page(Arena *arena) {
+  arena->current = 0;
+  arena->malloc_length = 0;
+  arena->free_length = 0;
+  arena->pages = 0;
+  arena->broken = false;
+  arena->total_count = 0;
+
+  arena->avail_next = 0;
+  arena->avail_prev = 0;
+  arena->in_avail = false;
+
+  arena->empty_next = 0;
+  arena->empty_prev = 0;
+  arena->in_empty = false;
+  arena->live_length = 0;
+
+  if (arena->is_root) {
+    arena->avail = 0;
+    arena->empty = 0;
+    arena->cursor = arena;
+    arena->defrag_cursor = 0;
+    arena->marks_length = 0;
+    arena->mark_top = 0;
+  }
+
+  arena->pending_length = 0;
 
-  arena->page_size = cfg.item_size * cfg.items_per_page;
-  arena->page_size = ARENA_ALIGN_UP(arena->page_size, cfg.alignment);
+  if (arena->live_bits != 0) {
+    arena_destroy_range(arena, 0, arena->bits_length * 64, true);
 
-  arena->refs = 0;
-  arena->last_free_ref = 0;
-  arena->malloc_length = 0;
-  arena->free_length = 0;
-  arena->total_count = 0;
+    memset(arena->live_bits, 0, arena->bits_length * sizeof(uint64_t));
+    memset(arena->dirty_bits, 0, arena->bits_length * sizeof(uint64_t));
 
-  // cfg.page_size = OR(cfg.page_size, ARENA_PAGE_SIZE);
-  //  cfg.page_size = ARENA_ALIGN_UP(cfg.page_size, cfg.alignment);
+    if (arena->freed_bits != 0)
+      arena_claim_all(arena);
 
-  if (!ARENA_IS_POWER_OF_2(cfg.alignment)) {
-    ARENA_WARNING(stderr, "alignment is not power of 2!\n");
-    arena->initialized = false;
-    return 0;
+    // handles to anything allocated before the reset become stale.
+    for (int64_t i = 0; i < arena->config.items_per_page; i++)
+      arena->generations[i]++;
   }
 
-  arena->config = cfg;
-  arena->next = 0;
-  arena->data = 0;
-  arena->current = 0;
-  arena->size = 0;
-  arena->broken = false;
+  // keep the range committed but hand the physical memory back.
+  if (arena->config.virtual_memory && arena->committed > 0)
+    madvise(arena->data, arena->committed, MADV_DONTNEED);
 
-  return 1;
+  arena->free_head = -1;
+
+  // pending remote frees point at slots that no longer exist.
+  atomic_store(&arena->remote_head, 0);
+  atomic_store(&arena->remote_pages, 0);
+  arena->remote_next = 0;
 }
 
-int arena_free(ArenaRef ref) {
+void *arena_at(Arena *arena, int64_t index) {
+  if (!arena || index < 0)
+    return 0;
 
-  Arena *arena = ref.arena;
+  for (Arena *page = arena; page != 0; page = page->next) {
+    if (index < page->config.items_per_page) {
+      if (index >= page->malloc_length || !ARENA_BIT_TEST(page->live_bits, index))
+        return 0;
+
+      return arena_slot_ptr(page, index);
+    }
+
+    index -= page->config.items_per_page;
+  }
+
+  return 0;
+}
 
+static int arena_reset_(Arena *arena) {
   if (!arena)
     return 0;
+
   if (!arena->initialized)
     ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
-  if (arena_is_broken(*arena))
-    ARENA_WARNING_RETURN(0, stderr, "This arena is broken.\n");
-
-  if (arena->refs == 0)
-    ARENA_WARNING_RETURN(0, stderr, "refs == null.\n");
-
-  if (ref.id >= arena->config.items_per_page || ref.id <= -1)
-    ARENA_WARNING_RETURN(0, stderr, "ref.id is invalid.\n");
 
-  ArenaRef *private_ref = &arena->refs[ref.id];
-  private_ref->in_use = false;
-  arena->last_free_ref = private_ref;
-  arena->free_length++;
+  for (Arena *page = arena; page != 0; page = page->next) {
+    arena_reset_page(page);
+  }
 
-  // arena_ArenaRef_buffer_push(&ref.arena->freed_memory, ref);
   return 1;
 }
 
-static ArenaRef *arena_malloc_(Arena *arena) {
+int arena_reset(Arena *arena) {
+  ARENA_PROFILE_BEGIN(profile, 0);
+  int ok = arena_reset_(arena);
+  ARENA_PROFILE_END(profile, ARENA_PROFILE_RESET, 0, ok);
+  return ok;
+}
+
+int64_t arena_collect(Arena *arena) {
   if (!arena)
-    ARENA_WARNING_RETURN(0, stderr, "arena == null.\n");
+    return 0;
   if (!arena->initialized)
     ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
 
-  int64_t size = arena->config.item_size;
-
-  if (size <= 0)
-    ARENA_WARNING_RETURN(0, stderr, "Invalid allocation size of %ld bytes.\n",
-			 size);
-  if (arena_is_broken(*arena))
-    ARENA_WARNING_RETURN(0, stderr, "This arena is broken.\n");
+  Arena *root = arena_get_root(arena);
+  int64_t count = 0;
 
-  // int64_t og_size = size;
-  size = ARENA_ALIGN_UP(size, arena->config.alignment);
+  for (Arena *page = arena; page != 0; page = page->next) {
+    if (page->pending_length <= 0)
+      continue;
 
-  int64_t data_size = size > arena->page_size ? size : arena->page_size;
+    count += arena_collect_page(page);
 
-  if (!arena->data) {
-    arena->data = calloc(1, data_size);
-    arena->size = data_size;
+    if (page->free_length > 0 && !page->in_avail)
+      arena_avail_push(root, page);
   }
 
-  arena->size = MAX(arena->size, data_size);
+  return count;
+}
 
-  if (!arena->data) {
-    arena->broken = true;
-    ARENA_WARNING_RETURN(0, stderr,
-			 "Arena has failed to allocate more memory.\n");
-  }
+ArenaMark arena_mark(Arena *arena) {
+  ArenaMark mark = {0};
 
-  if (!arena->refs) {
-    arena->refs =
-	(ArenaRef *)calloc(arena->config.items_per_page, sizeof(ArenaRef));
-  }
+  if (!arena_begin(arena))
+    return mark;
 
-  if (arena->malloc_length >= arena->config.items_per_page) {
-    goto find_free_ref;
-  }
+  Arena *page = arena->cursor;
+  uint64_t epoch = arena->mark_epoch + 1;
 
-  int64_t id =
-      arena->malloc_length; // arena->current / arena->config.items_per_page;
-  ArenaRef *ref = &arena->refs[id];
+  if (!arena_mark_push(arena, (ArenaMarkEntry){.slot = -1, .mark = epoch}))
+    ARENA_WARNING_RETURN(mark, stderr, "Failed to allocate mark.\n");
 
-  if (arena->malloc_length > 0) {
-    if (ref->ptr != 0 && ref->in_use) {
-      goto find_free_ref;
-    }
-  }
+  mark.page = page;
+  mark.current = page->current;
+  mark.malloc_length = page->malloc_length;
+  mark.entry = arena->marks_length - 1;
+  mark.epoch = epoch;
 
-  int64_t avail = arena->size - arena->current;
+  arena->mark_epoch = epoch;
+  arena->mark_top = epoch;
+  return mark;
+}
 
-  if (avail >= size) {
-    int64_t data_start = arena->current;
+// drops the slots of the page from malloc_length onwards.
+static void arena_rewind_page(Arena *root, Arena *page, int64_t current,
+                              int64_t malloc_length) {
+  if (page->malloc_length <= malloc_length)
+    return;
 
-    arena->current += size;
-    arena->malloc_length++;
+  if (page->live_bits != 0) {
+    arena_destroy_range(page, malloc_length, page->malloc_length, true);
 
-    ref->data_size = size;
-    ref->data_start = data_start;
-    ref->arena = arena;
-    ref->id = id;
+    for (int64_t id = malloc_length; id < page->malloc_length; id++) {
+      // a discarded slot can be pending its destructor.
+      if (page->config.destroy_policy == ARENA_DESTROY_DEFERRED &&
+          ARENA_BIT_TEST(page->dirty_bits, id) &&
+          !ARENA_BIT_TEST(page->live_bits, id))
+        page->pending_length--;
 
-    ref->ptr = arena->data + data_start;
-    ref->arena = arena;
-    ref->in_use = true;
-    return ref;
-  }
+      if (ARENA_BIT_TEST(page->live_bits, id))
+        page->live_length--;
 
-find_free_ref:
-  if (arena->last_free_ref != 0 &&
-      arena_ref_can_be_used(*arena->last_free_ref)) {
-    ref = arena->last_free_ref;
+      ARENA_BIT_CLEAR(page->live_bits, id);
+      ARENA_BIT_CLEAR(page->dirty_bits, id);
+      page->generations[id]++;
 
-    if (ref->ptr != 0) {
-      if (arena->config.free_function != 0) {
-        arena->config.free_function(ref->ptr);
-      } else if (arena->config.free_function_with_user_ptr != 0) {
-        arena->config.free_function_with_user_ptr(ref->ptr, arena->config.user_ptr_free);
-      }
+      if (page->freed_bits != 0)
+        arena_claim_slot(page, id);
     }
-    ref->in_use = true;
-    arena->free_length = MAX(0, arena->free_length - 1);
-    arena->last_free_ref = 0;
-    return ref;
-  }
 
-  if (arena->free_length > 0) {
-    for (int64_t i = 0; i < arena->config.items_per_page; i++) {
-      ref = &arena->refs[i];
-      if (!arena_ref_can_be_used(*ref))
-	continue;
+    // keep the freed slots that are still below the mark.
+    int32_t *link = 0;
+    int64_t id = page->free_head;
 
-      if (arena->config.free_function) {
-	arena->config.free_function(ref->ptr);
-      } else if (arena->config.free_function_with_user_ptr != 0) {
-        arena->config.free_function_with_user_ptr(ref->ptr, arena->config.user_ptr_free);
+    page->free_head = -1;
+    page->free_length = 0;
+
+    while (id >= 0) {
+      int64_t next = page->free_next[id];
+
+      if (id < malloc_length) {
+        if (link)
+          *link = id;
+        else
+          page->free_head = id;
+
+        link = &page->free_next[id];
+        page->free_length++;
       }
 
-      ref->in_use = true;
-      arena->free_length = MAX(0, arena->free_length - 1);
-      return ref;
+      id = next;
     }
+
+    if (link)
+      *link = -1;
+  } else {
+    page->live_length = malloc_length;
   }
 
-  return 0;
-}
+  if (page->free_length == 0)
+    arena_avail_remove(root, page);
 
-void *arena_malloc(Arena *arena, ArenaRef *user_ref) {
-  if (!arena)
-    ARENA_WARNING_RETURN(0, stderr, "arena == null.\n");
-  if (!arena->initialized)
-    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
-  if (arena_is_broken(*arena))
-    ARENA_WARNING_RETURN(0, stderr, "This arena is broken.\n");
+  page->current = current;
+  page->malloc_length = malloc_length;
 
-  int64_t size = arena->config.item_size;
+  if (malloc_length == 0)
+    arena_empty_remove(root, page);
+}
 
-  if (size <= 0)
-    ARENA_WARNING_RETURN(0, stderr, "Invalid allocation size of %ld bytes.\n",
-			 size);
-  if (arena->config.item_size > 0 && size != arena->config.item_size)
-    ARENA_WARNING_RETURN(0, stderr, "size != item_size");
+// destroys the object in a slot recycled after the mark, unless it was
+// freed since.
+static void arena_rewind_slot(Arena *page, int64_t id) {
+  if (id >= page->malloc_length || !ARENA_BIT_TEST(page->live_bits, id))
+    return;
 
-  arena->is_root = true;
-  Arena *last = arena;
+  void *item = arena_slot_ptr(page, id);
+  arena_destroy_items(page, &item, 1);
 
-  ArenaRef *ref = 0;
+  arena_push_free(page, id, false);
+  arena_page_freed(page, 1);
+}
 
-  user_ref->page = 0;
-  int64_t page = 0;
+int arena_rewind(Arena *arena, ArenaMark mark) {
+  if (!arena_begin(arena))
+    return 0;
+  if (!mark.page)
+    ARENA_WARNING_RETURN(0, stderr, "Mark does not belong to this arena.\n");
+
+  // the entry of a mark is only overwritten once the mark is dropped, and
+  // mark.page may be gone by then.
+  if (mark.entry < 0 || mark.entry >= arena->marks_length ||
+      arena->marks[mark.entry].page != 0 ||
+      arena->marks[mark.entry].mark != mark.epoch)
+    ARENA_WARNING_RETURN(0, stderr, "Mark was invalidated.\n");
+  if (mark.page != arena && mark.page->root != arena)
+    ARENA_WARNING_RETURN(0, stderr, "Mark does not belong to this arena.\n");
+
+  // pages first written after the mark are released whole.
+  for (Arena *page = mark.page->next; page != 0; page = page->next) {
+    if (page->malloc_length > 0 && page->epoch >= mark.epoch)
+      arena_rewind_page(arena, page, 0, 0);
+  }
 
-  while (last != 0 && last->broken == false) {
-    ref = arena_malloc_(last);
+  // older pages written since go back to where they stood, the earliest
+  // entry of a page last, and recycled slots are freed again.
+  for (int64_t i = arena->marks_length - 1; i > mark.entry; i--) {
+    ArenaMarkEntry *entry = &arena->marks[i];
 
-    if (ref != 0 && ref->ptr != 0 && ref->arena != 0) {
-      *user_ref = *ref;
-      user_ref->page = page;
-      arena->total_count++;
-      return ref->ptr;
-    }
+    if (entry->page == 0)
+      continue;
 
-    if (last->next == 0) {
-      Arena *next = NEW(Arena);
-      arena_init(next, arena->config);
-      next->prev = last;
-      last->next = next;
-      arena->pages++;
+    if (entry->slot >= 0) {
+      arena_rewind_slot(entry->page, entry->slot);
+      continue;
     }
-    Arena* tmp = last;
-    last = last->next;
 
-    page++;
+    arena_rewind_page(arena, entry->page, entry->current,
+                      entry->malloc_length);
+    entry->page->saved_mark = 0;
   }
 
-  printf("%ld\n", page);
-  if (page > 0) exit(0);
-  ARENA_WARNING_RETURN(0, stderr, "Failed to allocate memory.\n");
-}
-
-int arena_unuse_all(Arena *arena) {
-  if (!arena || arena->initialized == false || arena->refs == 0) return 0;
-  
-  for (int64_t i = 0; i < arena->config.items_per_page; i++) {
-    ArenaRef* ref = &arena->refs[i];
-    arena_free(*ref);
-  }
+  arena_rewind_page(arena, mark.page, mark.current, mark.malloc_length);
 
+  arena->marks_length = mark.entry + 1;
+  arena->mark_top = mark.epoch;
+  arena->cursor = mark.page;
+  arena->defrag_cursor = 0;
   return 1;
 }
 
-int arena_clear(Arena *arena) {
+bool arena_is_clean(Arena *arena) {
   if (!arena)
-    return 0;
-  if (!arena->initialized)
-    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+    return false;
+  return arena->live_length == 0;
+}
 
-  if (arena->refs != 0) {
-    for (int64_t i = 0; i < arena->config.items_per_page; i++) {
-      ArenaRef *ref = &arena->refs[i];
-      if (ref->in_use || ref->ptr == 0)
-	continue;
+static Arena *arena_get_root(Arena *arena) {
+  if (!arena) return 0;
+  if (arena->is_root) return arena;
+  if (arena->root != 0) return arena->root;
 
-      if (arena->config.free_function != 0) {
-	arena->config.free_function(ref->ptr);
-      } else if (arena->config.free_function_with_user_ptr != 0) {
-        arena->config.free_function_with_user_ptr(ref->ptr, arena->config.user_ptr_free);
-      }
 
-      ref->in_use = false;
-      ref->ptr = 0;
-      ref->arena = 0;
-      ref->data_size = 0;
-      ref->data_start = 0;
-      ref->page = 0;
-      arena->free_length = MAX(0, arena->free_length - 1);
-    }
+  if (!arena->prev) return 0;
+  Arena* left = arena->prev;
 
-    free(arena->refs);
-    arena->refs = 0;
+  while (left != 0) {
+    if (left->is_root) return left;
+    left = left->prev;
   }
 
-  // arena_ArenaRef_buffer_clear(&arena->freed_memory);
-
-  if (arena->data != 0) {
-    free(arena->data);
-    arena->data = 0;
-  }
+  if (left != 0 && left->is_root) return left;
+  return 0;
+}
 
-  arena->malloc_length = 0;
-  arena->free_length = 0;
-  arena->total_count = 0;
+int arena_defrag(Arena *arena) {
+  if (!arena)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
 
-  arena->size = 0;
-  arena->current = 0;
-  arena->broken = false;
-  arena->pages = 0;
-  return 1;
+  return arena_defrag_n(arena, -1) > 0;
 }
 
-static int arena_destroy_private(Arena *arena, bool should_free) {
+int64_t arena_defrag_n(Arena *arena, int64_t max_pages) {
   if (!arena)
     return 0;
   if (!arena->initialized)
     ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
 
-  arena_reset(arena);
-  arena_clear(arena);
+  Arena *root = arena_get_root(arena);
 
-  if (arena->next != 0) {
-    arena_destroy_private(arena->next, true);
-    arena->next = 0;
-  }
+  if (!root)
+    return 0;
 
-  if (should_free) {
-    free(arena);
-    arena = 0;
+  int64_t released = 0;
+
+  while (root->empty != 0 && (max_pages < 0 || released < max_pages)) {
+    Arena *page = root->empty;
+
+    arena_unlink_page(root, page);
+    arena_reset_(page);
+    arena_release_page(page);
+    released++;
   }
 
-  return 1;
+  return released;
 }
 
-int arena_destroy(Arena *arena) {
-  if (!arena)
-    return 0;
-  if (!arena->initialized)
-    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+static bool arena_page_sparse(Arena *page) {
+  return page->live_length > 0 &&
+         page->live_length * 100 <=
+             page->config.items_per_page * ARENA_COMPACT_SPARSE_PERCENT;
+}
 
-  return arena_destroy_private(arena, false);
+static int arena_compact_compare(const void *a, const void *b) {
+  int64_t x = (*(Arena *const *)a)->live_length;
+  int64_t y = (*(Arena *const *)b)->live_length;
+  return (x > y) - (x < y);
 }
 
-bool arena_is_broken(Arena arena) {
-  if (!arena.initialized)
-    return false;
-  return arena.broken;
+// whether compaction may put objects into the free slots of the page.
+// Empty pages are left to defrag, filling one would make it sparse again.
+static bool arena_compact_target(Arena *root, Arena *page) {
+  if (page->live_length == 0)
+    return page == root;
+  return page == root->cursor || !arena_page_sparse(page);
 }
 
-int arena_iterate(Arena *arena, ArenaIterator *it) {
-  if (!arena || !it)
-    return 0;
+// bump allocates a slot from the cursor on, never from a free list.
+static bool arena_compact_bump(Arena *root, void **ptr, ArenaRef *ref) {
+  while (true) {
+    Arena *page = root->cursor;
 
-find_arena:
+    if (!arena_prepare_page(page))
+      return false;
 
-  if (it->ref.id >= arena->malloc_length) {
-    if (it->arena != 0 && it->arena->next != 0) {
-      it->arena = it->arena->next;
-    } else {
-      return 0;
+    if (arena_bump_n_(page, 1, ptr, ref, 0) == 1) {
+      root->total_count++;
+      root->bump_count++;
+      return true;
     }
+
+    if (!arena_advance_cursor(root))
+      return false;
   }
+}
 
-  if (it->arena != 0) {
-    arena = it->arena;
+// takes a slot for an object moved off a page, preferring pages that are
+// not compaction candidates themselves so it doesn't have to move again.
+// target caches the page found for the previous object.
+static bool arena_compact_alloc(Arena *root, Arena **target, void **ptr,
+                                ArenaRef *ref) {
+  while (true) {
+    if (*target == 0 || !(*target)->in_avail) {
+      *target = 0;
+
+      for (Arena *other = root->avail; other != 0;
+           other = other->avail_next) {
+        if (arena_compact_target(root, other)) {
+          *target = other;
+          break;
+        }
+      }
+
+      if (*target == 0)
+        return arena_compact_bump(root, ptr, ref);
+    }
+
+    int64_t id = arena_reuse_(*target);
+
+    if ((*target)->free_length <= 0 || id < 0)
+      arena_avail_remove(root, *target);
+
+    if (id >= 0) {
+      *ptr = arena_slot_ptr(*target, id);
+      *ref = arena_make_ref(*target, id);
+      root->total_count++;
+      root->reuse_count++;
+      return true;
+    }
   }
+}
 
-  int64_t id = it->ref.id;
-  void *ptr = it->ref.ptr;
+// moves the live objects of a page that is off the avail list into other
+// slots. Returns 1 when the page was emptied and released, 0 when objects
+// are left on it and -1 when an allocation failed.
+static int arena_compact_page(Arena *root, Arena *page,
+                              ArenaRelocateFunction fn, void *user_ptr) {
+  bool failed = false;
+  Arena *target = 0;
 
-  for (int64_t i = id; i < arena->malloc_length; i++) {
-    ArenaRef ref = arena->refs[i];
-    if (!ref.ptr || ref.ptr == ptr)
-      continue;
+  for (int64_t w = 0; !failed && w < page->bits_length; w++) {
+    uint64_t live = page->live_bits[w];
+
+    while (live != 0) {
+      int64_t id = (w << 6) + __builtin_ctzll(live);
+      live &= live - 1;
+
+      void *old_ptr = arena_slot_ptr(page, id);
+      void *new_ptr = 0;
+      ArenaRef ref = {0};
+
+      if (!arena_compact_alloc(root, &target, &new_ptr, &ref)) {
+        failed = true;
+        break;
+      }
+
+      memcpy(new_ptr, old_ptr, page->slot_size);
+
+      // the object lives on elsewhere, nothing to destroy.
+      arena_push_free(page, id, false);
 
-    it->ref = ref;
-    it->ref.id = i;
-    it->arena = arena;
-    break;
+      if (fn != 0)
+        fn(user_ptr, old_ptr, new_ptr, arena_handle_from_ref(ref));
+    }
+  }
+
+  if (page->live_length == 0) {
+    arena_unlink_page(root, page);
+    arena_reset_(page);
+    arena_release_page(page);
+    return 1;
   }
 
-  bool found = it->ref.ptr != 0 && it->ref.ptr != ptr;
+  if (page->free_length > 0)
+    arena_avail_push(root, page);
+  return failed ? -1 : 0;
+}
+
+// whether slots outside page can take needed more objects, stopping as
+// soon as enough are found.
+static bool arena_compact_has_room(Arena *root, Arena *page, int64_t needed) {
+  int64_t room = 0;
+
+  for (Arena *other = root->avail; other != 0 && room < needed;
+       other = other->avail_next) {
+    if (other != page && arena_compact_target(root, other))
+      room += other->free_length;
+  }
 
-  if (!found && arena->next != 0) {
-    it->ref.id = 0;
-    it->arena = arena->next;
-    goto find_arena;
+  for (Arena *other = root->cursor; other != 0 && room < needed;
+       other = other->next) {
+    if (other != page)
+      room += arena_page_room(other);
   }
 
-  return found ? 1 : 0;
+  return room >= needed;
 }
 
-int64_t arena_get_allocation_count(Arena arena) {
-  if (!arena.initialized)
+int64_t arena_compact(Arena *arena, ArenaRelocateFunction fn, void *user_ptr) {
+  if (!arena_begin(arena))
     return 0;
-  if (arena.data == 0)
+  if (arena->config.bump || arena->config.virtual_memory)
     return 0;
-  return arena.total_count;
-}
 
-int arena_reset(Arena *arena) {
-  if (!arena)
+  int64_t length = 0;
+  int64_t capacity = 0;
+  Arena **sources = 0;
+
+  for (Arena *page = arena->next; page != 0 && page != arena->cursor;
+       page = page->next) {
+    if (arena_page_sparse(page))
+      length++;
+  }
+
+  if (length == 0)
     return 0;
 
-  if (!arena->initialized)
-    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+  sources = (Arena **)calloc(length, sizeof(Arena *));
+  if (!sources)
+    ARENA_WARNING_RETURN(0, stderr, "Failed to allocate compaction list.\n");
 
-  arena->current = 0;
-  arena->malloc_length = 0;
-  arena->free_length = 0;
-  arena->pages = 0;
-  arena->broken = false;
-  arena->size = 0;
-  arena->total_count = 0;
+  length = 0;
+  bool filling = false;
 
-  if (arena->refs != 0) {
-    for (int64_t i = 0; i < arena->config.items_per_page; i++) {
-      ArenaRef *ref = &arena->refs[i];
-      //      if (ref->in_use || ref->ptr == 0)
-      //      continue;
-
-      if (ref->arena != 0 && ref->ptr != 0 && ref->data_size > 0) {
-	if (arena->config.free_function) {
-	  arena->config.free_function(ref->ptr);
-	} else if (arena->config.free_function_with_user_ptr != 0) {
-          arena->config.free_function_with_user_ptr(ref->ptr, arena->config.user_ptr_free);
-        }
-      }
+  for (Arena *page = arena; page != 0; page = page->next) {
+    // pages from the cursor on are still being filled.
+    filling = filling || page == arena->cursor;
 
-      ref->in_use = false;
-      ref->ptr = 0;
-      ref->arena = 0;
-      ref->data_size = 0;
-      ref->data_start = 0;
-      ref->page = 0;
-      arena->free_length = MAX(0, arena->free_length - 1);
+    if (page != arena && !filling && arena_page_sparse(page)) {
+      sources[length++] = page;
+    } else {
+      if (arena_compact_target(arena, page))
+        capacity += page->free_length;
+      if (filling)
+        capacity += arena_page_room(page);
     }
-
-    //    free(arena->refs);
-    //   arena->refs = 0;
   }
 
-  // arena->last_free_ref = 0;
+  // sparsest first, as many as the other pages have room for.
+  qsort(sources, length, sizeof(Arena *), arena_compact_compare);
 
-  if (arena->next != 0) {
-    arena_reset(arena->next);
-  }
+  int64_t used = 0;
+  int64_t count = 0;
 
-  return 1;
-}
+  while (count < length && used + sources[count]->live_length <= capacity)
+    used += sources[count++]->live_length;
 
-bool arena_is_clean(Arena *arena) {
-  if (arena->free_length >= arena->config.items_per_page)
-    return true;
+  for (int64_t i = 0; i < count; i++)
+    arena_avail_remove(arena, sources[i]);
 
-  int64_t count = 0;
-  for (int64_t i = 0; i < arena->config.items_per_page; i++) {
-    ArenaRef *ref = &arena->refs[i];
-    count += (int)(arena_ref_can_be_used(*ref) || ref->ptr == 0);
+  int64_t released = 0;
+  int64_t i = 0;
+
+  for (; i < count; i++) {
+    int result = arena_compact_page(arena, sources[i], fn, user_ptr);
+
+    if (result < 0)
+      break;
+    released += result;
   }
 
-  return count >= arena->config.items_per_page;
+  // sources left after a failed allocation go back on the avail list.
+  for (i++; i < count; i++) {
+    if (sources[i]->free_length > 0)
+      arena_avail_push(arena, sources[i]);
+  }
+
+  free(sources);
+  return released;
 }
 
-static Arena *arena_get_root(Arena *arena) {
-  if (!arena) return 0;
-  if (arena->is_root) return arena;
+static int64_t arena_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
+static bool arena_budget_left(ArenaDefragBudget budget, int64_t done,
+                              int64_t deadline) {
+  return (budget.pages <= 0 || done < budget.pages) &&
+         (deadline == 0 || arena_now_ns() < deadline);
+}
 
-  if (!arena->prev) return 0;
-  Arena* left = arena->prev;
+bool arena_defrag_step(Arena *arena, ArenaDefragBudget budget,
+                       ArenaRelocateFunction fn, void *user_ptr) {
+  if (!arena_begin(arena))
+    return false;
 
-  while (left != 0) {
-    if (left->is_root) return left;
-    left = left->prev;
+  if (budget.pages <= 0 && budget.nanoseconds <= 0)
+    budget.pages = 1;
+
+  int64_t deadline =
+      budget.nanoseconds > 0 ? arena_now_ns() + budget.nanoseconds : 0;
+  int64_t done = 0;
+
+  while (arena->empty != 0 && arena_budget_left(budget, done, deadline)) {
+    Arena *page = arena->empty;
+
+    arena_unlink_page(arena, page);
+    arena_reset_(page);
+    arena_release_page(page);
+    done++;
   }
 
-  if (left != 0 && left->is_root) return left;
-  return 0;
-}
+  if (arena->empty != 0)
+    return true;
 
-int arena_defrag(Arena *arena) {
-  if (!arena)
-    return 0;
-  if (!arena->initialized)
-    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+  if (!budget.compact || arena->config.bump || arena->config.virtual_memory)
+    return false;
 
-  Arena* prev = arena->prev;
-  Arena* next = arena->next;
+  Arena *page = OR(arena->defrag_cursor, arena->next);
 
+  while (page != 0 && page != arena->cursor &&
+         arena_budget_left(budget, done, deadline)) {
+    Arena *next = page->next;
 
-  if (!arena_is_clean(arena) && next != 0) return arena_defrag(next);
+    if (arena_page_sparse(page) &&
+        arena_compact_has_room(arena, page, page->live_length)) {
+      arena_avail_remove(arena, page);
 
+      if (arena_compact_page(arena, page, fn, user_ptr) < 0) {
+        page = 0;
+        break;
+      }
 
-  if (arena->is_root || !arena_is_clean(arena)) return 0;
+      done++;
+    }
 
-  if (prev && prev->next == arena) {
-    prev->next = next;
+    page = next;
   }
 
-  if (next && next->prev == arena) {
-    next->prev = prev;
-  }
+  // the pass is over once it reaches the cursor, the next step starts over.
+  if (page == arena->cursor)
+    page = 0;
+
+  arena->defrag_cursor = page;
+  return page != 0;
+}
 
+int64_t arena_trim(Arena *arena) {
+  if (!arena_begin(arena))
+    return 0;
 
-  Arena* root = arena_get_root(arena);
+  int64_t bytes = 0;
+  Arena *page = arena->cursor->next;
 
-  if (!root) ARENA_WARNING_RETURN(0, stderr, "Expected root.\n");
-  
-  root->pages = MAX(root->pages-1, 0);
+  while (page != 0) {
+    Arena *next = page->next;
 
-  arena_reset(arena);
-  arena_clear(arena);
-  free(arena);
-  arena = 0;
+    if (page->malloc_length == 0 && page->pending_length == 0) {
+      arena_unlink_page(arena, page);
+      bytes += page->size;
+      arena_clear(page);
+      free(page);
+    }
 
-  return 1;
+    page = next;
+  }
+
+  return bytes;
 }
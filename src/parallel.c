@@ -0,0 +1,236 @@
+#include <arena/parallel.h>
+#include <arena/macros.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  Arena *page;
+  int64_t start;
+  int64_t end;
+} ArenaParallelChunk;
+
+typedef struct {
+  ArenaParallelChunk *chunks;
+  int64_t length;
+  int64_t threads;
+
+  ArenaParallelFunction fn;
+  void *user_ptr;
+
+  _Atomic int64_t next;
+  _Atomic int64_t visited;
+} ArenaParallelJob;
+
+// the built-in pool, workers sleep on `work` between jobs.
+static struct {
+  pthread_mutex_t call_lock;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+
+  pthread_t threads[ARENA_PARALLEL_MAX_THREADS];
+  int64_t length;
+
+  ArenaParallelJob *job;
+  uint64_t generation;
+  uint64_t started_generation;
+  int64_t active;
+  bool stop;
+
+  ArenaParallelChunk *chunks;
+  int64_t chunks_capacity;
+} arena_parallel = {.call_lock = PTHREAD_MUTEX_INITIALIZER,
+                    .lock = PTHREAD_MUTEX_INITIALIZER,
+                    .work = PTHREAD_COND_INITIALIZER,
+                    .done = PTHREAD_COND_INITIALIZER};
+
+static void arena_parallel_run(ArenaParallelJob *job, int64_t thread_index) {
+  int64_t visited = 0;
+  int64_t i;
+
+  while ((i = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed)) <
+         job->length) {
+    ArenaParallelChunk chunk = job->chunks[i];
+    char *data = (char *)chunk.page->data;
+    int64_t size = chunk.page->slot_size;
+
+    for (int64_t w = chunk.start; w < chunk.end; w++) {
+      uint64_t live = chunk.page->live_bits[w];
+
+      while (live != 0) {
+        int64_t id = (w << 6) + __builtin_ctzll(live);
+        live &= live - 1;
+
+        job->fn(job->user_ptr, data + id * size, thread_index);
+        visited++;
+      }
+    }
+  }
+
+  atomic_fetch_add_explicit(&job->visited, visited, memory_order_relaxed);
+}
+
+static void *arena_parallel_worker(void *arg) {
+  int64_t thread_index = (int64_t)(intptr_t)arg;
+
+  // the generation when the thread was started, it may only get to run
+  // after the next job was posted.
+  pthread_mutex_lock(&arena_parallel.lock);
+  uint64_t seen = arena_parallel.started_generation;
+
+  while (true) {
+    while (!arena_parallel.stop && arena_parallel.generation == seen)
+      pthread_cond_wait(&arena_parallel.work, &arena_parallel.lock);
+
+    if (arena_parallel.stop)
+      break;
+
+    seen = arena_parallel.generation;
+    ArenaParallelJob *job = arena_parallel.job;
+
+    if (thread_index >= job->threads)
+      continue;
+
+    pthread_mutex_unlock(&arena_parallel.lock);
+    arena_parallel_run(job, thread_index);
+    pthread_mutex_lock(&arena_parallel.lock);
+
+    if (--arena_parallel.active == 0)
+      pthread_cond_signal(&arena_parallel.done);
+  }
+
+  pthread_mutex_unlock(&arena_parallel.lock);
+  return 0;
+}
+
+// starts workers 1 .. nthreads - 1, returns the number of threads usable.
+static int64_t arena_parallel_start(int64_t nthreads) {
+  pthread_mutex_lock(&arena_parallel.lock);
+  arena_parallel.started_generation = arena_parallel.generation;
+
+  while (arena_parallel.length < nthreads - 1) {
+    int64_t thread_index = arena_parallel.length + 1;
+
+    if (pthread_create(&arena_parallel.threads[arena_parallel.length], 0,
+                       arena_parallel_worker,
+                       (void *)(intptr_t)thread_index) != 0)
+      break;
+
+    arena_parallel.length++;
+  }
+
+  pthread_mutex_unlock(&arena_parallel.lock);
+  return arena_parallel.length + 1;
+}
+
+// splits the live part of every page into chunks.
+static int64_t arena_parallel_split(Arena *arena) {
+  int64_t length = 0;
+
+  for (Arena *page = arena; page != 0; page = page->next) {
+    if (page->live_bits == 0 || page->live_length == 0)
+      continue;
+
+    int64_t words = ARENA_BITS_WORDS(page->malloc_length);
+
+    for (int64_t w = 0; w < words; w += ARENA_PARALLEL_CHUNK_WORDS) {
+      if (length >= arena_parallel.chunks_capacity) {
+        int64_t capacity = MAX(64, arena_parallel.chunks_capacity * 2);
+        ArenaParallelChunk *chunks = (ArenaParallelChunk *)realloc(
+            arena_parallel.chunks, capacity * sizeof(ArenaParallelChunk));
+
+        if (!chunks)
+          ARENA_WARNING_RETURN(-1, stderr, "Failed to allocate chunks.\n");
+
+        arena_parallel.chunks = chunks;
+        arena_parallel.chunks_capacity = capacity;
+      }
+
+      arena_parallel.chunks[length++] = (ArenaParallelChunk){
+          .page = page,
+          .start = w,
+          .end = MIN(words, w + ARENA_PARALLEL_CHUNK_WORDS)};
+    }
+  }
+
+  return length;
+}
+
+int64_t arena_parallel_for_each(Arena *arena, ArenaParallelFunction fn,
+                                void *user_ptr, int64_t nthreads) {
+  if (!arena || !fn)
+    return 0;
+  if (!arena->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  if (nthreads <= 0)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  nthreads = MIN(MAX(nthreads, 1), ARENA_PARALLEL_MAX_THREADS);
+
+  pthread_mutex_lock(&arena_parallel.call_lock);
+
+  int64_t length = arena_parallel_split(arena);
+
+  if (length <= 0) {
+    pthread_mutex_unlock(&arena_parallel.call_lock);
+    return 0;
+  }
+
+  ArenaParallelJob job = {.chunks = arena_parallel.chunks,
+                          .length = length,
+                          .threads = MIN(nthreads, length),
+                          .fn = fn,
+                          .user_ptr = user_ptr};
+  atomic_init(&job.next, 0);
+  atomic_init(&job.visited, 0);
+
+  if (job.threads > 1)
+    job.threads = MIN(job.threads, arena_parallel_start(job.threads));
+
+  if (job.threads > 1) {
+    pthread_mutex_lock(&arena_parallel.lock);
+    arena_parallel.job = &job;
+    arena_parallel.active = job.threads - 1;
+    arena_parallel.generation++;
+    pthread_cond_broadcast(&arena_parallel.work);
+    pthread_mutex_unlock(&arena_parallel.lock);
+  }
+
+  arena_parallel_run(&job, 0);
+
+  if (job.threads > 1) {
+    pthread_mutex_lock(&arena_parallel.lock);
+    while (arena_parallel.active > 0)
+      pthread_cond_wait(&arena_parallel.done, &arena_parallel.lock);
+    arena_parallel.job = 0;
+    pthread_mutex_unlock(&arena_parallel.lock);
+  }
+
+  pthread_mutex_unlock(&arena_parallel.call_lock);
+  return atomic_load(&job.visited);
+}
+
+int arena_parallel_shutdown() {
+  pthread_mutex_lock(&arena_parallel.call_lock);
+
+  pthread_mutex_lock(&arena_parallel.lock);
+  arena_parallel.stop = true;
+  pthread_cond_broadcast(&arena_parallel.work);
+  pthread_mutex_unlock(&arena_parallel.lock);
+
+  for (int64_t i = 0; i < arena_parallel.length; i++)
+    pthread_join(arena_parallel.threads[i], 0);
+
+  arena_parallel.length = 0;
+  arena_parallel.stop = false;
+
+  free(arena_parallel.chunks);
+  arena_parallel.chunks = 0;
+  arena_parallel.chunks_capacity = 0;
+
+  pthread_mutex_unlock(&arena_parallel.call_lock);
+  return 1;
+}
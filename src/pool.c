@@ -0,0 +1,271 @@
+#include <arena/pool.h>
+#include <arena/macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// moves data and slot metadata from src to dst, src is left without.
+static void arena_page_pool_move(Arena *dst, Arena *src) {
+  dst->data = src->data;
+  dst->size = src->size;
+  dst->reserved = src->reserved;
+  dst->committed = src->committed;
+  dst->backing = src->backing;
+  dst->free_next = src->free_next;
+  dst->free_head = -1;
+  dst->live_bits = src->live_bits;
+  dst->dirty_bits = src->dirty_bits;
+  dst->bits_length = src->bits_length;
+  dst->generations = src->generations;
+  dst->freed_bits = src->freed_bits;
+  dst->slot_size = src->slot_size;
+  dst->page_size = src->page_size;
+  dst->config.items_per_page = src->config.items_per_page;
+
+  src->data = 0;
+  src->size = 0;
+  src->reserved = 0;
+  src->committed = 0;
+  src->backing = 0;
+  src->free_next = 0;
+  src->live_bits = 0;
+  src->dirty_bits = 0;
+  src->bits_length = 0;
+  src->generations = 0;
+  src->freed_bits = 0;
+}
+
+static void arena_page_pool_free_page(Arena *page) {
+  arena_clear(page);
+  free(page);
+}
+
+int arena_page_pool_init(ArenaPagePool *pool, int64_t max_bytes) {
+  if (!pool)
+    return 0;
+  if (pool->initialized)
+    return 1;
+
+  if (pthread_mutex_init(&pool->lock, 0) != 0)
+    ARENA_WARNING_RETURN(0, stderr, "Failed to create lock.\n");
+
+  pool->pages = 0;
+  pool->length = 0;
+  pool->bytes = 0;
+  pool->max_bytes = OR(max_bytes, ARENA_POOL_MAX_BYTES);
+  pool->spare = 0;
+  pool->page_table = 0;
+  pool->free_indices = 0;
+  pool->index_generations = 0;
+  pool->page_table_length = 0;
+  pool->initialized = true;
+  return 1;
+}
+
+int arena_page_pool_destroy(ArenaPagePool *pool) {
+  if (!pool)
+    return 0;
+  if (!pool->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Pool not initialized.\n");
+
+  arena_page_pool_trim(pool, 0);
+
+  while (pool->spare != 0) {
+    Arena *next = pool->spare->next;
+    free(pool->spare);
+    pool->spare = next;
+  }
+
+  free(pool->page_table);
+  free(pool->free_indices);
+  free(pool->index_generations);
+  pool->page_table = 0;
+  pool->free_indices = 0;
+  pool->index_generations = 0;
+  pool->page_table_length = 0;
+
+  pthread_mutex_destroy(&pool->lock);
+  pool->initialized = false;
+  return 1;
+}
+
+int64_t arena_page_pool_trim(ArenaPagePool *pool, int64_t max_bytes) {
+  if (!pool || !pool->initialized)
+    return 0;
+
+  int64_t freed = 0;
+
+  pthread_mutex_lock(&pool->lock);
+
+  while (pool->pages != 0 && pool->bytes > max_bytes) {
+    Arena *page = pool->pages;
+    pool->pages = page->next;
+    pool->length--;
+    pool->bytes -= page->size;
+    freed += page->size;
+
+    page->next = 0;
+    arena_page_pool_free_page(page);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  return freed;
+}
+
+bool arena_page_pool_put(ArenaPagePool *pool, Arena *page, bool owned) {
+  if (!pool || !pool->initialized || !page || !page->data)
+    return false;
+
+  // reserved address space is not worth keeping around.
+  if (page->backing & ARENA_BACKING_VIRTUAL_MEMORY)
+    return false;
+
+  pthread_mutex_lock(&pool->lock);
+
+  if (pool->bytes + page->size > pool->max_bytes) {
+    pthread_mutex_unlock(&pool->lock);
+    return false;
+  }
+
+  Arena *node = page;
+
+  if (!owned) {
+    node = pool->spare;
+
+    if (node != 0) {
+      pool->spare = node->next;
+    } else if ((node = NEW(Arena)) == 0) {
+      pthread_mutex_unlock(&pool->lock);
+      return false;
+    }
+
+    node->initialized = true;
+    node->config = page->config;
+    arena_page_pool_move(node, page);
+  }
+
+  node->prev = 0;
+  node->next = pool->pages;
+  pool->pages = node;
+  pool->length++;
+  pool->bytes += node->size;
+
+  pthread_mutex_unlock(&pool->lock);
+  return true;
+}
+
+bool arena_page_pool_take(ArenaPagePool *pool, Arena *page) {
+  if (!pool || !pool->initialized || !page || page->data != 0)
+    return false;
+
+  pthread_mutex_lock(&pool->lock);
+
+  Arena *prev = 0;
+  Arena *node = pool->pages;
+
+  while (node != 0 && (node->slot_size != page->slot_size ||
+                       node->page_size != page->page_size ||
+                       node->config.items_per_page !=
+                           page->config.items_per_page)) {
+    prev = node;
+    node = node->next;
+  }
+
+  if (node == 0) {
+    pthread_mutex_unlock(&pool->lock);
+    return false;
+  }
+
+  if (prev != 0) {
+    prev->next = node->next;
+  } else {
+    pool->pages = node->next;
+  }
+
+  pool->length--;
+  pool->bytes -= node->size;
+
+  arena_page_pool_move(page, node);
+
+  memset(node, 0, sizeof(Arena));
+  node->next = pool->spare;
+  pool->spare = node;
+
+  pthread_mutex_unlock(&pool->lock);
+  return true;
+}
+
+bool arena_page_pool_put_table(ArenaPagePool *pool, Arena *root) {
+  if (!pool || !pool->initialized || !root || !root->page_table)
+    return false;
+
+  pthread_mutex_lock(&pool->lock);
+
+  if (pool->page_table != 0) {
+    pthread_mutex_unlock(&pool->lock);
+    return false;
+  }
+
+  pool->page_table = root->page_table;
+  pool->free_indices = root->free_indices;
+  pool->index_generations = root->index_generations;
+  pool->page_table_length = root->page_table_length;
+
+  pthread_mutex_unlock(&pool->lock);
+
+  root->page_table = 0;
+  root->free_indices = 0;
+  root->index_generations = 0;
+  root->page_table_length = 0;
+  return true;
+}
+
+bool arena_page_pool_take_table(ArenaPagePool *pool, Arena *root) {
+  if (!pool || !pool->initialized || !root || root->page_table != 0)
+    return false;
+
+  pthread_mutex_lock(&pool->lock);
+
+  if (pool->page_table == 0) {
+    pthread_mutex_unlock(&pool->lock);
+    return false;
+  }
+
+  root->page_table = pool->page_table;
+  root->free_indices = pool->free_indices;
+  root->index_generations = pool->index_generations;
+  root->page_table_length = pool->page_table_length;
+
+  pool->page_table = 0;
+  pool->free_indices = 0;
+  pool->index_generations = 0;
+  pool->page_table_length = 0;
+
+  pthread_mutex_unlock(&pool->lock);
+
+  // handles into the last root must not resolve in this one.
+  memset(root->page_table, 0, root->page_table_length * sizeof(Arena *));
+  memset(root->index_generations, 0,
+         root->page_table_length * sizeof(uint16_t));
+  root->free_indices_length = 0;
+  return true;
+}
+
+Arena *arena_page_pool_new_page(ArenaPagePool *pool) {
+  if (!pool || !pool->initialized)
+    return NEW(Arena);
+
+  pthread_mutex_lock(&pool->lock);
+
+  Arena *page = pool->spare;
+  if (page != 0)
+    pool->spare = page->next;
+
+  pthread_mutex_unlock(&pool->lock);
+
+  if (page == 0)
+    return NEW(Arena);
+
+  memset(page, 0, sizeof(Arena));
+  return page;
+}
@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+#include <arena/profile.h>
+#include <arena/macros.h>
+#include <stdio.h>
+
+#ifdef ARENA_PROFILE
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  void *site;
+  int64_t samples;
+  int64_t objects;
+  int64_t new_pages;
+} ArenaProfileSite;
+
+_Atomic bool arena_profile_enabled = false;
+
+static struct {
+  pthread_mutex_t lock;
+  _Atomic int64_t sample_rate;
+
+  _Atomic int64_t histograms[ARENA_PROFILE_OPS][ARENA_PROFILE_BUCKETS];
+  _Atomic int64_t calls[ARENA_PROFILE_OPS];
+  _Atomic int64_t total_ns[ARENA_PROFILE_OPS];
+
+  // open addressing on the return address, guarded by lock.
+  ArenaProfileSite sites[ARENA_PROFILE_SITES];
+  int64_t sites_length;
+  int64_t dropped;
+} arena_profile = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                   .sample_rate = ARENA_PROFILE_SAMPLE_RATE};
+
+static _Thread_local int64_t arena_profile_countdown;
+
+static const char *arena_profile_op_names[ARENA_PROFILE_OPS] = {
+    "malloc", "free", "reset"};
+
+int64_t arena_profile_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void arena_profile_sample(void *site, int64_t samples,
+                                 int64_t objects, int64_t new_pages) {
+  uint64_t hash = (uint64_t)(uintptr_t)site * 0x9E3779B97F4A7C15ULL;
+  int64_t i = (int64_t)(hash >> 32) % ARENA_PROFILE_SITES;
+
+  pthread_mutex_lock(&arena_profile.lock);
+
+  for (int64_t probe = 0; probe < ARENA_PROFILE_SITES; probe++) {
+    ArenaProfileSite *entry = &arena_profile.sites[i];
+
+    if (entry->site == 0) {
+      entry->site = site;
+      arena_profile.sites_length++;
+    }
+
+    if (entry->site == site) {
+      entry->samples += samples;
+      entry->objects += objects;
+      entry->new_pages += new_pages;
+      pthread_mutex_unlock(&arena_profile.lock);
+      return;
+    }
+
+    i = (i + 1) % ARENA_PROFILE_SITES;
+  }
+
+  arena_profile.dropped++;
+  pthread_mutex_unlock(&arena_profile.lock);
+}
+
+void arena_profile_leave(ArenaProfileScope *scope, ArenaProfileOp op,
+                         Arena *arena, int64_t count, void *site) {
+  int64_t ns = arena_profile_now() - scope->start;
+  int64_t bucket = ns > 0 ? 64 - __builtin_clzll((uint64_t)ns) : 0;
+  bucket = MIN(bucket, ARENA_PROFILE_BUCKETS - 1);
+
+  atomic_fetch_add_explicit(&arena_profile.histograms[op][bucket], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&arena_profile.calls[op], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&arena_profile.total_ns[op], ns,
+                            memory_order_relaxed);
+
+  if (op != ARENA_PROFILE_MALLOC)
+    return;
+
+  int64_t new_pages = arena != 0 ? arena->new_page_count - scope->new_pages : 0;
+
+  if (arena_profile_countdown <= 0)
+    arena_profile_countdown = atomic_load_explicit(&arena_profile.sample_rate,
+                                                   memory_order_relaxed);
+
+  bool sampled = --arena_profile_countdown == 0;
+
+  // growth is rare enough to record every time.
+  if (sampled || new_pages > 0)
+    arena_profile_sample(site, sampled, sampled ? count : 0, new_pages);
+}
+
+int arena_profile_start(int64_t sample_rate) {
+  atomic_store(&arena_profile.sample_rate,
+               sample_rate > 0 ? sample_rate : ARENA_PROFILE_SAMPLE_RATE);
+  atomic_store(&arena_profile_enabled, true);
+  return 1;
+}
+
+int arena_profile_stop() {
+  atomic_store(&arena_profile_enabled, false);
+  return 1;
+}
+
+int arena_profile_clear() {
+  for (int64_t op = 0; op < ARENA_PROFILE_OPS; op++) {
+    for (int64_t i = 0; i < ARENA_PROFILE_BUCKETS; i++)
+      atomic_store(&arena_profile.histograms[op][i], 0);
+    atomic_store(&arena_profile.calls[op], 0);
+    atomic_store(&arena_profile.total_ns[op], 0);
+  }
+
+  pthread_mutex_lock(&arena_profile.lock);
+  memset(arena_profile.sites, 0, sizeof(arena_profile.sites));
+  arena_profile.sites_length = 0;
+  arena_profile.dropped = 0;
+  pthread_mutex_unlock(&arena_profile.lock);
+  return 1;
+}
+
+int arena_profile_histogram(ArenaProfileOp op, int64_t *buckets) {
+  if (!buckets || op < 0 || op >= ARENA_PROFILE_OPS)
+    return 0;
+
+  for (int64_t i = 0; i < ARENA_PROFILE_BUCKETS; i++)
+    buckets[i] = atomic_load(&arena_profile.histograms[op][i]);
+  return 1;
+}
+
+// the upper bound in ns of the bucket holding the given fraction of calls.
+static int64_t arena_profile_percentile(const int64_t *buckets, int64_t calls,
+                                        double fraction) {
+  int64_t seen = 0;
+
+  for (int64_t i = 0; i < ARENA_PROFILE_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen > 0 && seen >= (int64_t)(fraction * calls))
+      return 1LL << i;
+  }
+
+  return 0;
+}
+
+static int arena_profile_compare(const void *a, const void *b) {
+  const ArenaProfileSite *x = (const ArenaProfileSite *)a;
+  const ArenaProfileSite *y = (const ArenaProfileSite *)b;
+
+  if (x->new_pages != y->new_pages)
+    return (x->new_pages < y->new_pages) - (x->new_pages > y->new_pages);
+  return (x->samples < y->samples) - (x->samples > y->samples);
+}
+
+int arena_profile_dump(const char *path, ArenaProfileFormat format) {
+  if (!path)
+    return 0;
+
+  FILE *fp = fopen(path, "w");
+  if (!fp)
+    ARENA_WARNING_RETURN(0, stderr, "Failed to open %s.\n", path);
+
+  bool json = format == ARENA_PROFILE_JSON;
+  int64_t rate = atomic_load(&arena_profile.sample_rate);
+
+  pthread_mutex_lock(&arena_profile.lock);
+
+  int64_t length = 0;
+  ArenaProfileSite *sites = (ArenaProfileSite *)calloc(
+      MAX(arena_profile.sites_length, 1), sizeof(ArenaProfileSite));
+
+  if (!sites) {
+    pthread_mutex_unlock(&arena_profile.lock);
+    fclose(fp);
+    ARENA_WARNING_RETURN(0, stderr, "Failed to allocate sites.\n");
+  }
+
+  for (int64_t i = 0; i < ARENA_PROFILE_SITES; i++) {
+    if (arena_profile.sites[i].site != 0)
+      sites[length++] = arena_profile.sites[i];
+  }
+
+  int64_t dropped = arena_profile.dropped;
+  pthread_mutex_unlock(&arena_profile.lock);
+
+  qsort(sites, length, sizeof(ArenaProfileSite), arena_profile_compare);
+
+  if (json) {
+    fprintf(fp, "{\n  \"sample_rate\": %ld,\n  \"operations\": [\n", rate);
+  } else {
+    fprintf(fp, "arena profile, 1 in %ld allocations sampled\n\n", rate);
+    fprintf(fp, "%-8s %12s %10s %10s %10s\n", "op", "calls", "mean_ns",
+            "p50_ns", "p99_ns");
+  }
+
+  for (int64_t op = 0; op < ARENA_PROFILE_OPS; op++) {
+    int64_t buckets[ARENA_PROFILE_BUCKETS];
+    arena_profile_histogram((ArenaProfileOp)op, buckets);
+
+    int64_t calls = atomic_load(&arena_profile.calls[op]);
+    int64_t mean = calls > 0 ? atomic_load(&arena_profile.total_ns[op]) / calls
+                             : 0;
+    int64_t p50 = arena_profile_percentile(buckets, calls, 0.5);
+    int64_t p99 = arena_profile_percentile(buckets, calls, 0.99);
+
+    if (!json) {
+      fprintf(fp, "%-8s %12ld %10ld %10ld %10ld\n", arena_profile_op_names[op],
+              calls, mean, p50, p99);
+      continue;
+    }
+
+    fprintf(fp,
+            "    {\"op\": \"%s\", \"calls\": %ld, \"mean_ns\": %ld, "
+            "\"p50_ns\": %ld, \"p99_ns\": %ld, \"buckets\": [",
+            arena_profile_op_names[op], calls, mean, p50, p99);
+
+    for (int64_t i = 0; i < ARENA_PROFILE_BUCKETS; i++)
+      fprintf(fp, "%s%ld", i > 0 ? ", " : "", buckets[i]);
+
+    fprintf(fp, "]}%s\n", op + 1 < ARENA_PROFILE_OPS ? "," : "");
+  }
+
+  if (!json) {
+    fprintf(fp, "\nlatency buckets (calls taking < N ns)\n");
+
+    for (int64_t i = 0; i < ARENA_PROFILE_BUCKETS; i++) {
+      int64_t counts[ARENA_PROFILE_OPS];
+      int64_t any = 0;
+
+      for (int64_t op = 0; op < ARENA_PROFILE_OPS; op++)
+        any += counts[op] = atomic_load(&arena_profile.histograms[op][i]);
+
+      if (any > 0)
+        fprintf(fp, "  < %-14lld %12ld %12ld %12ld\n", 1LL << i,
+                counts[ARENA_PROFILE_MALLOC], counts[ARENA_PROFILE_FREE],
+                counts[ARENA_PROFILE_RESET]);
+    }
+
+    fprintf(fp, "\n%-18s %10s %12s %10s  %s\n", "site", "samples",
+            "est_allocs", "new_pages", "location");
+  } else {
+    fprintf(fp, "  ],\n  \"dropped_sites\": %ld,\n  \"sites\": [\n", dropped);
+  }
+
+  for (int64_t i = 0; i < length; i++) {
+    Dl_info info = {0};
+    const char *module = "?";
+    const char *symbol = "?";
+    uintptr_t offset = (uintptr_t)sites[i].site;
+
+    if (dladdr(sites[i].site, &info) != 0) {
+      module = OR(info.dli_fname, module);
+      symbol = OR(info.dli_sname, symbol);
+      offset -= (uintptr_t)info.dli_fbase;
+    }
+
+    // the offset into the module is what addr2line expects.
+    if (json) {
+      fprintf(fp,
+              "    {\"site\": \"%p\", \"samples\": %ld, \"objects\": %ld, "
+              "\"new_pages\": %ld, \"module\": \"%s\", \"symbol\": \"%s\", "
+              "\"offset\": \"0x%lx\"}%s\n",
+              sites[i].site, sites[i].samples, sites[i].objects,
+              sites[i].new_pages, module, symbol, (unsigned long)offset,
+              i + 1 < length ? "," : "");
+    } else {
+      fprintf(fp, "%-18p %10ld %12ld %10ld  %s(%s+0x%lx)\n", sites[i].site,
+              sites[i].samples, sites[i].objects * rate, sites[i].new_pages,
+              module, symbol, (unsigned long)offset);
+    }
+  }
+
+  if (json)
+    fprintf(fp, "  ]\n}\n");
+  else if (dropped > 0)
+    fprintf(fp, "\n%ld samples dropped, the site table is full\n", dropped);
+
+  free(sites);
+  fclose(fp);
+  return 1;
+}
+
+#else
+
+int arena_profile_start(int64_t sample_rate) {
+  ARENA_WARNING_RETURN(0, stderr, "Built without ARENA_PROFILE.\n");
+}
+
+int arena_profile_stop() { return 0; }
+
+int arena_profile_clear() { return 0; }
+
+int arena_profile_histogram(ArenaProfileOp op, int64_t *buckets) { return 0; }
+
+int arena_profile_dump(const char *path, ArenaProfileFormat format) {
+  ARENA_WARNING_RETURN(0, stderr, "Built without ARENA_PROFILE.\n");
+}
+
+#endif
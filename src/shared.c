@@ -0,0 +1,161 @@
+#include <arena/shared.h>
+#include <arena/macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int arena_shared_init(ArenaShared *shared, ArenaConfig cfg) {
+  if (!shared)
+    return 0;
+  if (shared->initialized)
+    return 1;
+
+  if (!arena_init(&shared->arena, cfg))
+    return 0;
+
+  if (pthread_mutex_init(&shared->lock, 0) != 0) {
+    arena_destroy(&shared->arena);
+    ARENA_WARNING_RETURN(0, stderr, "Failed to create lock.\n");
+  }
+
+  shared->initialized = true;
+  return 1;
+}
+
+int arena_shared_destroy(ArenaShared *shared) {
+  if (!shared)
+    return 0;
+  if (!shared->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  pthread_mutex_lock(&shared->lock);
+  arena_destroy(&shared->arena);
+  pthread_mutex_unlock(&shared->lock);
+
+  pthread_mutex_destroy(&shared->lock);
+  shared->initialized = false;
+  return 1;
+}
+
+int arena_thread_cache_init(ArenaThreadCache *cache, ArenaShared *shared) {
+  if (!cache || !shared)
+    return 0;
+  if (!shared->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  cache->shared = shared;
+  cache->length = 0;
+
+  // copied so the fast path never reads the shared arena.
+  cache->free_function = shared->arena.config.free_function;
+  cache->free_function_with_user_ptr =
+      shared->arena.config.free_function_with_user_ptr;
+  cache->free_batch_function = shared->arena.config.free_batch_function;
+  cache->user_ptr_free = shared->arena.config.user_ptr_free;
+  cache->destroy_policy = shared->arena.config.destroy_policy;
+  return 1;
+}
+
+static void arena_thread_cache_destroy(ArenaThreadCache *cache, void *ptr) {
+  if (cache->free_batch_function != 0) {
+    cache->free_batch_function(&ptr, 1, cache->user_ptr_free);
+  } else if (cache->free_function != 0) {
+    cache->free_function(ptr);
+  } else if (cache->free_function_with_user_ptr != 0) {
+    cache->free_function_with_user_ptr(ptr, cache->user_ptr_free);
+  }
+}
+
+static int arena_thread_cache_refill(ArenaThreadCache *cache) {
+  ArenaShared *shared = cache->shared;
+  int64_t count = MIN(ARENA_THREAD_CACHE_BATCH,
+                      ARENA_THREAD_CACHE_SIZE - cache->length);
+
+  pthread_mutex_lock(&shared->lock);
+  int64_t got = arena_malloc_n(&shared->arena, count, 0,
+                               &cache->refs[cache->length], 0);
+  pthread_mutex_unlock(&shared->lock);
+
+  memset(&cache->dirty[cache->length], 0, got * sizeof(bool));
+  cache->length += got;
+
+  return cache->length > 0;
+}
+
+// returns the `count` oldest cached slots to the shared arena.
+static void arena_thread_cache_flush_n(ArenaThreadCache *cache, int64_t count) {
+  ArenaShared *shared = cache->shared;
+  count = MIN(count, cache->length);
+
+  if (count <= 0)
+    return;
+
+  pthread_mutex_lock(&shared->lock);
+
+  for (int64_t i = 0; i < count; i++) {
+    if (cache->dirty[i]) {
+      arena_free(cache->refs[i]);
+    } else {
+      arena_release(cache->refs[i]);
+    }
+  }
+
+  pthread_mutex_unlock(&shared->lock);
+
+  int64_t rest = cache->length - count;
+  memmove(&cache->refs[0], &cache->refs[count], rest * sizeof(ArenaRef));
+  memmove(&cache->dirty[0], &cache->dirty[count], rest * sizeof(bool));
+  cache->length = rest;
+}
+
+void *arena_shared_malloc(ArenaThreadCache *cache, ArenaRef *ref) {
+  if (!cache || !cache->shared || !ref)
+    return 0;
+
+  if (cache->length <= 0 && !arena_thread_cache_refill(cache))
+    ARENA_WARNING_RETURN(0, stderr, "Failed to allocate memory.\n");
+
+  cache->length--;
+  *ref = cache->refs[cache->length];
+
+  if (cache->dirty[cache->length])
+    arena_thread_cache_destroy(cache, ref->ptr);
+
+  return ref->ptr;
+}
+
+int arena_shared_free(ArenaThreadCache *cache, ArenaRef ref) {
+  if (!cache || !cache->shared || !ref.arena)
+    return 0;
+
+  // deferred objects wait in the shared arena for arena_collect.
+  if (cache->destroy_policy == ARENA_DESTROY_DEFERRED) {
+    pthread_mutex_lock(&cache->shared->lock);
+    int ok = arena_free(ref);
+    pthread_mutex_unlock(&cache->shared->lock);
+    return ok;
+  }
+
+  bool dirty = true;
+
+  if (cache->destroy_policy == ARENA_DESTROY_EAGER) {
+    arena_thread_cache_destroy(cache, ref.ptr);
+    dirty = false;
+  }
+
+  if (cache->length >= ARENA_THREAD_CACHE_SIZE)
+    arena_thread_cache_flush_n(cache, ARENA_THREAD_CACHE_BATCH);
+
+  cache->refs[cache->length] = ref;
+  cache->dirty[cache->length] = dirty;
+  cache->length++;
+  return 1;
+}
+
+int arena_thread_cache_flush(ArenaThreadCache *cache) {
+  if (!cache || !cache->shared)
+    return 0;
+
+  arena_thread_cache_flush_n(cache, cache->length);
+  return 1;
+}
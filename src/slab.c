@@ -0,0 +1,202 @@
+#include <arena/slab.h>
+#include <arena/macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int64_t arena_slab_class_size(int64_t index) {
+  if (index < 16)
+    return (index + 1) * 16;
+
+  int64_t k = index - 16;
+  int64_t shift = 8 + k / 4;
+  return (1LL << shift) + (k % 4 + 1) * (1LL << (shift - 2));
+}
+
+static int64_t arena_slab_class_index(size_t size) {
+  if (size <= 256)
+    return size == 0 ? 0 : (int64_t)(size + 15) / 16 - 1;
+
+  int64_t shift = 63 - __builtin_clzll(size - 1);
+  return 16 + (shift - 8) * 4 + (int64_t)((size - 1) >> (shift - 2)) - 4;
+}
+
+// the index of the last page starting at or below ptr, -1 when none does.
+static int64_t arena_slab_search(ArenaSlab *slab, const char *ptr) {
+  int64_t lo = 0;
+  int64_t hi = slab->pages_length - 1;
+  int64_t found = -1;
+
+  while (lo <= hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+
+    if (slab->pages[mid].data <= ptr) {
+      found = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  return found;
+}
+
+// the class page holding ptr, or null for the malloc fallback.
+static Arena *arena_slab_find(ArenaSlab *slab, void *ptr) {
+  int64_t i = arena_slab_search(slab, (char *)ptr);
+
+  if (i < 0)
+    return 0;
+
+  ArenaSlabPage *entry = &slab->pages[i];
+
+  // a page that was given new memory leaves a stale entry behind.
+  if (entry->page->data != entry->data ||
+      (char *)ptr >= entry->data + entry->page->size)
+    return 0;
+
+  return entry->page;
+}
+
+static bool arena_slab_add_page(ArenaSlab *slab, Arena *page) {
+  char *data = (char *)page->data;
+
+  // drop the page's old entry and any stale one its memory now covers,
+  // either would shadow the page on lookup.
+  int64_t kept = 0;
+  for (int64_t j = 0; j < slab->pages_length; j++) {
+    ArenaSlabPage entry = slab->pages[j];
+    if (entry.page == page ||
+        (entry.data >= data && entry.data < data + page->size))
+      continue;
+    slab->pages[kept++] = entry;
+  }
+  slab->pages_length = kept;
+
+  int64_t i = arena_slab_search(slab, data);
+
+  if (slab->pages_length >= slab->pages_capacity) {
+    int64_t capacity = MAX(64, slab->pages_capacity * 2);
+    ArenaSlabPage *pages = (ArenaSlabPage *)realloc(
+        slab->pages, capacity * sizeof(ArenaSlabPage));
+    if (!pages)
+      return false;
+
+    slab->pages = pages;
+    slab->pages_capacity = capacity;
+  }
+
+  memmove(&slab->pages[i + 2], &slab->pages[i + 1],
+          (slab->pages_length - i - 1) * sizeof(ArenaSlabPage));
+  slab->pages[i + 1] = (ArenaSlabPage){.data = data, .page = page};
+  slab->pages_length++;
+  return true;
+}
+
+int arena_slab_init(ArenaSlab *slab, ArenaConfig cfg) {
+  if (!slab)
+    return 0;
+  if (slab->initialized)
+    return 1;
+
+  // slots are plain memory, there is no object to run a destructor on.
+  cfg.free_function = 0;
+  cfg.free_function_with_user_ptr = 0;
+  cfg.bump = false;
+  cfg.alignment = MAX(cfg.alignment, ARENA_SLAB_ALIGNMENT);
+
+  for (int64_t i = 0; i < ARENA_SLAB_CLASSES; i++) {
+    ArenaConfig class_cfg = cfg;
+    class_cfg.item_size = arena_slab_class_size(i);
+    class_cfg.items_per_page =
+        MAX(ARENA_ITEMS_PER_PAGE, ARENA_SLAB_PAGE_SIZE / class_cfg.item_size);
+
+    memset(&slab->classes[i], 0, sizeof(Arena));
+
+    if (!arena_init(&slab->classes[i], class_cfg)) {
+      for (int64_t j = 0; j < i; j++)
+        arena_destroy(&slab->classes[j]);
+      ARENA_WARNING_RETURN(0, stderr, "Failed to initialize size class.\n");
+    }
+  }
+
+  slab->pages = 0;
+  slab->pages_length = 0;
+  slab->pages_capacity = 0;
+  slab->config = cfg;
+  slab->initialized = true;
+  return 1;
+}
+
+int arena_slab_destroy(ArenaSlab *slab) {
+  if (!slab)
+    return 0;
+  if (!slab->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  for (int64_t i = 0; i < ARENA_SLAB_CLASSES; i++)
+    arena_destroy(&slab->classes[i]);
+
+  free(slab->pages);
+  slab->pages = 0;
+  slab->pages_length = 0;
+  slab->pages_capacity = 0;
+  slab->initialized = false;
+  return 1;
+}
+
+void *arena_slab_malloc(ArenaSlab *slab, size_t size) {
+  if (!slab)
+    return 0;
+  if (!slab->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  void *ptr = 0;
+
+  if (size > ARENA_SLAB_MAX_SIZE) {
+    ptr = malloc(size);
+  } else {
+    ArenaRef ref = {0};
+    ptr = arena_malloc(&slab->classes[arena_slab_class_index(size)], &ref);
+
+    // the first slot of a page is carved when the page gets its memory.
+    if (ptr && ref.id == 0 && !arena_slab_add_page(slab, ref.arena)) {
+      arena_free(ref);
+      ptr = 0;
+    }
+  }
+
+  if (!ptr)
+    ARENA_WARNING_RETURN(0, stderr, "Failed to allocate %zu bytes.\n", size);
+
+  return ptr;
+}
+
+int arena_slab_free(ArenaSlab *slab, void *ptr) {
+  if (!slab || !ptr)
+    return 0;
+  if (!slab->initialized)
+    ARENA_WARNING_RETURN(0, stderr, "Arena not initialized.\n");
+
+  Arena *page = arena_slab_find(slab, ptr);
+
+  if (page == 0) {
+    free(ptr);
+    return 1;
+  }
+
+  int64_t id = ((char *)ptr - (char *)page->data) / page->slot_size;
+  return arena_free((ArenaRef){.arena = page, .id = id});
+}
+
+size_t arena_slab_size(ArenaSlab *slab, void *ptr) {
+  if (!slab || !ptr)
+    return 0;
+
+  Arena *page = arena_slab_find(slab, ptr);
+
+  if (page == 0)
+    return 0;
+
+  return page->config.item_size;
+}
@@ -5,6 +5,13 @@
 #include <arena/arena.h>
 #include <arena/macros.h>
 #include <arena/list.h>
+#include <arena/constants.h>
+#include <arena/shared.h>
+#include <arena/slab.h>
+#include <arena/pool.h>
+#include <arena/parallel.h>
+#include <arena/profile.h>
+#include <pthread.h>
 #include <assert.h>
 #include <string.h>
 #include <date/date.h>
@@ -272,6 +279,1341 @@ void test_arena_defrag() {
   arena_destroy(&arena);
 }
 
+void test_arena_many_pages(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = items_per_page });
+
+  ArenaRef first = {0};
+  ARENA_ASSERT(arena_malloc(&arena, &first) != 0);
+
+  int64_t last_page = 0;
+  for (int64_t i = 1; i < count; i++) {
+    ArenaRef ref = {0};
+    Person* p = arena_malloc(&arena, &ref);
+    ARENA_ASSERT(p != 0);
+    ARENA_ASSERT(ref.page >= last_page);
+    last_page = ref.page;
+
+    if (i % 3 == 0) {
+      ARENA_ASSERT(arena_free(ref) != 0);
+    }
+  }
+
+  ARENA_ASSERT(arena.cursor == arena.tail);
+  ARENA_ASSERT(arena.pages == last_page);
+
+  ARENA_ASSERT(arena_free(first) != 0);
+
+  ArenaRef ref = {0};
+  ARENA_ASSERT(arena_malloc(&arena, &ref) == first.ptr);
+  ARENA_ASSERT(ref.page == 0);
+
+  arena_destroy(&arena);
+  ARENA_ASSERT(arena.next == 0);
+}
+
+void test_arena_free_list(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = items_per_page });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+
+  for (int64_t i = 0; i < count; i++) {
+    ARENA_ASSERT(arena_malloc(&arena, &refs[i]) != 0);
+  }
+
+  for (int64_t i = 0; i < count; i += 2) {
+    ARENA_ASSERT(arena_free(refs[i]) != 0);
+  }
+
+  ARENA_ASSERT(arena_free(refs[0]) == 0);
+
+  int64_t pages = arena.pages;
+
+  for (int64_t i = count - 2 + (count % 2); i >= 0; i -= 2) {
+    ArenaRef ref = {0};
+    ARENA_ASSERT(arena_malloc(&arena, &ref) == refs[i].ptr);
+  }
+
+  ARENA_ASSERT(arena.pages == pages);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+void test_arena_iterate_and_clean(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = items_per_page });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+
+  for (int64_t i = 0; i < count; i++) {
+    Person* p = arena_malloc(&arena, &refs[i]);
+    ARENA_ASSERT(p != 0);
+    p->age = i;
+  }
+
+  ARENA_ASSERT(!arena_is_clean(&arena));
+
+  ArenaIterator it = {0};
+  int64_t n = 0;
+  while (arena_iterate(&arena, &it)) {
+    Person* p = (Person*)it.ref.ptr;
+    ARENA_ASSERT(p->age == n);
+    n++;
+  }
+  ARENA_ASSERT(n == count);
+
+  for (int64_t i = 0; i < MIN(count, items_per_page); i++) {
+    ARENA_ASSERT(arena_free(refs[i]) != 0);
+  }
+
+  ARENA_ASSERT(arena_is_clean(&arena));
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+void test_arena_growth(int64_t count, ArenaGrowth growth, int64_t max_pages) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = 4, .growth = growth, .max_items_per_page = 64, .free_function = (ArenaFreeFunction)person_free });
+
+  for (int64_t i = 0; i < count; i++) {
+    ArenaRef ref = {0};
+    Person* p = arena_malloc(&arena, &ref);
+    ARENA_ASSERT(p != 0);
+    p->name = strdup("John");
+  }
+
+  ARENA_ASSERT(arena.pages <= max_pages);
+  ARENA_ASSERT(arena.config.items_per_page == 4);
+
+  arena_destroy(&arena);
+  ARENA_ASSERT(arena.next == 0);
+}
+
+void test_arena_virtual_memory(int64_t count) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = 16, .virtual_memory = true, .reserve_size = count * sizeof(Person) * 2, .free_function = (ArenaFreeFunction)person_free });
+
+  Person* first = 0;
+  for (int64_t i = 0; i < count; i++) {
+    ArenaRef ref = {0};
+    Person* p = arena_malloc(&arena, &ref);
+    ARENA_ASSERT(p != 0);
+    first = first ? first : p;
+    ARENA_ASSERT(p == first + i);
+    ARENA_ASSERT(arena_at(&arena, i) == p);
+    p->age = i;
+    p->name = strdup("John");
+  }
+
+  ARENA_ASSERT(arena.pages == 0);
+  ARENA_ASSERT(arena.next == 0);
+  ARENA_ASSERT(arena_at(&arena, count) == 0);
+
+  arena_reset(&arena);
+  ARENA_ASSERT(arena_at(&arena, 0) == 0);
+
+  ArenaRef ref = {0};
+  ARENA_ASSERT(arena_malloc(&arena, &ref) == first);
+  ARENA_ASSERT(first->name == 0);
+  first->name = strdup("Sarah");
+
+  arena_destroy(&arena);
+}
+
+void test_arena_huge_pages(int64_t count) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = 4096, .items_per_page = 1024, .huge_pages = true, .prefault = true });
+
+  for (int64_t i = 0; i < count; i++) {
+    ArenaRef ref = {0};
+    char* data = arena_malloc(&arena, &ref);
+    ARENA_ASSERT(data != 0);
+    data[0] = 1;
+  }
+
+  ARENA_ASSERT((arena.backing & ARENA_BACKING_MMAP) != 0);
+  ARENA_ASSERT((arena.backing & ARENA_BACKING_PREFAULTED) != 0);
+  ARENA_ASSERT(((uintptr_t)arena.data % ARENA_HUGE_PAGE_SIZE) == 0);
+  arena_destroy(&arena);
+
+  Arena vm = {0};
+  arena_init(&vm, (ArenaConfig){ .item_size = sizeof(Person), .virtual_memory = true, .reserve_size = 1 << 26, .huge_pages = true, .prefault = true });
+
+  ArenaRef ref = {0};
+  ARENA_ASSERT(arena_malloc(&vm, &ref) != 0);
+  ARENA_ASSERT((vm.backing & ARENA_BACKING_VIRTUAL_MEMORY) != 0);
+  ARENA_ASSERT((vm.backing & ARENA_BACKING_PREFAULTED) != 0);
+  arena_destroy(&vm);
+}
+
+typedef struct {
+  ArenaShared* shared;
+  int64_t count;
+} SharedTestJob;
+
+static void* shared_test_worker(void* ptr) {
+  SharedTestJob* job = (SharedTestJob*)ptr;
+  ArenaThreadCache cache = {0};
+  ARENA_ASSERT(arena_thread_cache_init(&cache, job->shared) != 0);
+
+  ArenaRef* refs = calloc(job->count, sizeof(ArenaRef));
+
+  for (int round = 0; round < 4; round++) {
+    for (int64_t i = 0; i < job->count; i++) {
+      Person* p = arena_shared_malloc(&cache, &refs[i]);
+      assert(p != 0);
+      assert(p->name == 0);
+      p->name = strdup("John");
+    }
+
+    for (int64_t i = 0; i < job->count; i++) {
+      assert(strcmp(((Person*)refs[i].ptr)->name, "John") == 0);
+      assert(arena_shared_free(&cache, refs[i]) != 0);
+    }
+  }
+
+  arena_thread_cache_flush(&cache);
+  free(refs);
+  return 0;
+}
+
+void test_arena_shared(int64_t nr_threads, int64_t count) {
+  ArenaShared shared = {0};
+  ARENA_ASSERT(arena_shared_init(&shared, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = 64, .free_function = (ArenaFreeFunction)person_free }) != 0);
+
+  pthread_t threads[16];
+  SharedTestJob job = { .shared = &shared, .count = count };
+
+  for (int64_t i = 0; i < nr_threads; i++) {
+    pthread_create(&threads[i], 0, shared_test_worker, &job);
+  }
+
+  for (int64_t i = 0; i < nr_threads; i++) {
+    pthread_join(threads[i], 0);
+  }
+
+  for (Arena* page = &shared.arena; page != 0; page = page->next) {
+    ARENA_ASSERT(arena_is_clean(page));
+  }
+
+  arena_shared_destroy(&shared);
+}
+
+typedef struct {
+  ArenaRef* refs;
+  int64_t start;
+  int64_t end;
+} RemoteFreeJob;
+
+static void* remote_free_worker(void* ptr) {
+  RemoteFreeJob* job = (RemoteFreeJob*)ptr;
+  for (int64_t i = job->start; i < job->end; i++) {
+    assert(arena_free(job->refs[i]) != 0);
+  }
+  return 0;
+}
+
+void test_arena_remote_free(int64_t count) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = 16, .remote_free = true, .free_function = (ArenaFreeFunction)person_free });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+
+  for (int round = 0; round < 3; round++) {
+    for (int64_t i = 0; i < count; i++) {
+      Person* p = arena_malloc(&arena, &refs[i]);
+      ARENA_ASSERT(p != 0);
+      ARENA_ASSERT(p->name == 0);
+      p->name = strdup("John");
+    }
+
+    pthread_t threads[4];
+    RemoteFreeJob jobs[4];
+    for (int64_t t = 0; t < 4; t++) {
+      jobs[t] = (RemoteFreeJob){ .refs = refs, .start = t * count / 4, .end = (t + 1) * count / 4 };
+      pthread_create(&threads[t], 0, remote_free_worker, &jobs[t]);
+    }
+
+    for (int64_t t = 0; t < 4; t++) {
+      pthread_join(threads[t], 0);
+    }
+  }
+
+  ARENA_ASSERT(arena.pages == (count / 16) - 1);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+void test_arena_remote_free_concurrent(int64_t count) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = 16, .remote_free = true });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+  for (int64_t i = 0; i < count; i++)
+    *(int64_t*)arena_malloc(&arena, &refs[i]) = i;
+
+  // the owner keeps allocating, and draining, while the slots come back.
+  pthread_t threads[4];
+  RemoteFreeJob jobs[4];
+  for (int64_t t = 0; t < 4; t++) {
+    jobs[t] = (RemoteFreeJob){ .refs = refs, .start = t * count / 4, .end = (t + 1) * count / 4 };
+    pthread_create(&threads[t], 0, remote_free_worker, &jobs[t]);
+  }
+
+  for (int64_t i = 0; i < count; i++) {
+    int64_t* value = arena_malloc(&arena, 0);
+    ARENA_ASSERT(value != 0);
+    *value = count + i;
+  }
+
+  for (int64_t t = 0; t < 4; t++)
+    pthread_join(threads[t], 0);
+
+  // drains whatever was freed after the last allocation.
+  ARENA_ASSERT(arena_malloc(&arena, 0) != 0);
+
+  ArenaStats stats = {0};
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  ARENA_ASSERT(stats.live == count + 1);
+  ARENA_ASSERT(stats.live + stats.free + stats.pending == stats.carved);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+typedef struct {
+  ArenaRef* refs;
+  int64_t count;
+  int64_t freed;
+} RemoteDoubleFreeJob;
+
+static void* remote_double_free_worker(void* ptr) {
+  RemoteDoubleFreeJob* job = (RemoteDoubleFreeJob*)ptr;
+  for (int64_t i = 0; i < job->count; i++) job->freed += arena_free(job->refs[i]);
+  return 0;
+}
+
+// threads freeing the same objects, only one free of each goes through.
+void test_arena_remote_double_free(int64_t count) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = 16, .remote_free = true });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+
+  for (int round = 0; round < 3; round++) {
+    for (int64_t i = 0; i < count; i++)
+      *(int64_t*)arena_malloc(&arena, &refs[i]) = i;
+
+    pthread_t threads[4];
+    RemoteDoubleFreeJob jobs[4];
+    for (int64_t t = 0; t < 4; t++) {
+      jobs[t] = (RemoteDoubleFreeJob){ .refs = refs, .count = count };
+      pthread_create(&threads[t], 0, remote_double_free_worker, &jobs[t]);
+    }
+
+    int64_t freed = 0;
+    for (int64_t t = 0; t < 4; t++) {
+      pthread_join(threads[t], 0);
+      freed += jobs[t].freed;
+    }
+    ARENA_ASSERT(freed == count);
+
+    // the owner is refused too, the slots are already on their way back.
+    ARENA_ASSERT(arena_free(refs[0]) == 0);
+    ARENA_ASSERT(arena_free_n(refs, count) == 0);
+  }
+
+  // the drain finds each slot once, all of them are reused.
+  ArenaStats before = {0};
+  ARENA_ASSERT(arena_get_stats(&arena, &before) != 0);
+  for (int64_t i = 0; i < count; i++) ARENA_ASSERT(arena_malloc(&arena, 0) != 0);
+
+  ArenaStats stats = {0};
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  ARENA_ASSERT(stats.pages == before.pages);
+  ARENA_ASSERT(stats.live == count && stats.free == 0);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+void test_arena_malloc_n(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = items_per_page, .free_function = (ArenaFreeFunction)person_free });
+
+  void** ptrs = calloc(count, sizeof(void*));
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+
+  ARENA_ASSERT(arena_malloc_n(&arena, count, ptrs, refs, 0) == count);
+
+  for (int64_t i = 0; i < count; i++) {
+    ARENA_ASSERT(ptrs[i] == refs[i].ptr);
+    ((Person*)ptrs[i])->name = strdup("John");
+  }
+
+  for (int64_t i = 0; i < count; i += 2) {
+    ARENA_ASSERT(arena_free(refs[i]) != 0);
+  }
+
+  // half of the batch recycles the freed slots, the rest is bumped.
+  ARENA_ASSERT(arena_malloc_n(&arena, count, ptrs, 0, 0) == count);
+
+  for (int64_t i = 0; i < count; i++) {
+    ARENA_ASSERT(((Person*)ptrs[i])->name == 0);
+    ((Person*)ptrs[i])->name = strdup("Sarah");
+  }
+
+  ARENA_ASSERT(arena_malloc_n(&arena, count, ptrs, refs, ARENA_MALLOC_CONTIGUOUS) == count);
+
+  for (int64_t i = 0; i < count; i++) {
+    ARENA_ASSERT((Person*)ptrs[i] == (Person*)ptrs[0] + i);
+    ARENA_ASSERT(refs[i].arena == refs[0].arena);
+    ((Person*)ptrs[i])->name = strdup("John");
+  }
+
+  // a batch no page can hold is refused, the arena stays usable.
+  int64_t pages = 0;
+  for (Arena* page = &arena; page != 0; page = page->next) pages++;
+  ARENA_ASSERT(arena_malloc_n(&arena, ARENA_MAX_SLOTS + 1, 0, 0, ARENA_MALLOC_CONTIGUOUS) == 0);
+  ARENA_ASSERT(arena_malloc_n(&arena, -1, 0, 0, 0) == 0);
+  for (Arena* page = &arena; page != 0; page = page->next) pages--;
+  ARENA_ASSERT(pages == 0 && !arena.broken);
+
+  Person* person = arena_malloc(&arena, 0);
+  ARENA_ASSERT(person != 0);
+  person->name = strdup("Anna");
+
+  free(ptrs);
+  free(refs);
+  arena_destroy(&arena);
+}
+
+static bool person_is_expired(void* user_ptr, void* data_ptr) {
+  int64_t* now = (int64_t*)user_ptr;
+  return ((Person*)data_ptr)->age < *now;
+}
+
+void test_arena_free_n_and_if(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(Person), .items_per_page = items_per_page, .free_function = (ArenaFreeFunction)person_free });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+  ARENA_ASSERT(arena_malloc_n(&arena, count, 0, refs, 0) == count);
+
+  for (int64_t i = 0; i < count; i++) {
+    Person* p = (Person*)refs[i].ptr;
+    p->age = i;
+    p->name = strdup("John");
+  }
+
+  ARENA_ASSERT(arena_free_n(refs, count / 2) == count / 2);
+  ARENA_ASSERT(arena_free_n(refs, count / 2) == 0);
+
+  int64_t now = (count * 3) / 4;
+  ARENA_ASSERT(arena_free_if(&arena, person_is_expired, &now) == now - count / 2);
+
+  int64_t live = 0;
+  for (Arena* page = &arena; page != 0; page = page->next) {
+    for (int64_t i = 0; i < page->malloc_length; i++) {
+      if (!ARENA_BIT_TEST(page->live_bits, i)) continue;
+      ARENA_ASSERT(((Person*)((char*)page->data + i * page->slot_size))->age >= now);
+      live++;
+    }
+  }
+  ARENA_ASSERT(live == count - now);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+void test_arena_handle_churn(int64_t cycles) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = 1 });
+
+  // the root keeps its object, every cycle creates and releases a page.
+  ArenaHandle keep = ARENA_HANDLE_NULL;
+  *(int64_t*)arena_malloc_handle(&arena, &keep) = -1;
+
+  ArenaHandle stale = ARENA_HANDLE_NULL;
+  bool ok = true;
+
+  for (int64_t i = 0; i < cycles && ok; i++) {
+    ArenaHandle handle = ARENA_HANDLE_NULL;
+    int64_t* value = arena_malloc_handle(&arena, &handle);
+
+    ok = value != 0 && handle != ARENA_HANDLE_NULL && arena_get(&arena, handle) == value &&
+         (stale == ARENA_HANDLE_NULL || arena_get(&arena, stale) == 0) &&
+         arena_free_handle(&arena, handle) != 0 && arena_defrag_n(&arena, -1) == 1;
+    stale = handle;
+  }
+
+  ARENA_ASSERT(ok);
+  ARENA_ASSERT(arena.page_table_length <= 16);
+  ARENA_ASSERT(*(int64_t*)arena_get(&arena, keep) == -1);
+
+  arena_destroy(&arena);
+}
+
+void test_arena_handles(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  ArenaHandle* handles = calloc(count, sizeof(ArenaHandle));
+
+  for (int64_t i = 0; i < count; i++) {
+    int64_t* value = arena_malloc_handle(&arena, &handles[i]);
+    ARENA_ASSERT(value != 0);
+    ARENA_ASSERT(handles[i] != ARENA_HANDLE_NULL);
+    *value = i;
+  }
+
+  for (int64_t i = 0; i < count; i++) {
+    int64_t* value = arena_get(&arena, handles[i]);
+    ARENA_ASSERT(value != 0 && *value == i);
+  }
+
+  ARENA_ASSERT(arena_free_handle(&arena, handles[0]) != 0);
+  ARENA_ASSERT(arena_get(&arena, handles[0]) == 0);
+  ARENA_ASSERT(arena_free_handle(&arena, handles[0]) == 0);
+
+  ArenaHandle reused = ARENA_HANDLE_NULL;
+  ARENA_ASSERT(arena_malloc_handle(&arena, &reused) != 0);
+  ARENA_ASSERT(reused != handles[0]);
+  ARENA_ASSERT(arena_get(&arena, handles[0]) == 0);
+  ARENA_ASSERT(arena_get(&arena, reused) != 0);
+
+  arena_reset(&arena);
+  ARENA_ASSERT(arena_get(&arena, reused) == 0);
+  ARENA_ASSERT(arena_get(&arena, handles[count - 1]) == 0);
+
+  free(handles);
+  arena_destroy(&arena);
+}
+
+void test_arena_malloc_size(int64_t count, bool virtual_memory) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .bump = true, .page_size = 4096, .virtual_memory = virtual_memory, .reserve_size = 1 << 24 });
+
+  char** strings = calloc(count, sizeof(char*));
+  int64_t chain[2] = {0};
+
+  for (int round = 0; round < 2; round++) {
+    for (int64_t i = 0; i < count; i++) {
+      size_t length = 1 + (i * 37) % 200;
+      size_t align = (size_t)1 << (i % 5);
+      char* s = arena_malloc_size(&arena, length, align);
+      ARENA_ASSERT(s != 0);
+      ARENA_ASSERT(((uintptr_t)s & (align - 1)) == 0);
+      memset(s, 'a' + i % 26, length - 1);
+      s[length - 1] = 0;
+      strings[i] = s;
+    }
+
+    for (int64_t i = 0; i < count; i++) {
+      ARENA_ASSERT(strlen(strings[i]) == (size_t)(i * 37) % 200);
+      ARENA_ASSERT(strings[i][0] == 0 || strings[i][0] == 'a' + i % 26);
+    }
+
+    Arena* cursor = arena.cursor;
+    char* big = arena_malloc_size(&arena, 100000, 64);
+    ARENA_ASSERT(big != 0 && ((uintptr_t)big & 63) == 0);
+    memset(big, 1, 100000);
+    if (!virtual_memory) ARENA_ASSERT(arena.cursor == cursor);
+
+    for (Arena* page = &arena; page != 0; page = page->next) chain[round]++;
+    arena_reset(&arena);
+  }
+
+  // the second round refills the pages the first one left behind, only the
+  // big allocation needs a new one.
+  ARENA_ASSERT(chain[1] <= chain[0] + 1);
+
+  ARENA_ASSERT(arena_malloc(&arena, 0) == 0);
+
+  free(strings);
+  arena_destroy(&arena);
+}
+
+// a reservation that is not a power of two is used up to its last page.
+void test_arena_malloc_size_reserve(int64_t reserve) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .bump = true, .virtual_memory = true, .reserve_size = reserve });
+
+  int64_t used = 0;
+  char* last = 0;
+  while ((last = arena_malloc_size(&arena, 1000, 8)) != 0) {
+    memset(last, 1, 1000);
+    used += 1000;
+  }
+
+  ARENA_ASSERT(arena.committed == arena.reserved);
+  ARENA_ASSERT(used > reserve - 2048);
+
+  arena_destroy(&arena);
+}
+
+void test_arena_slab(int64_t count) {
+  ArenaSlab slab = {0};
+  ARENA_ASSERT(arena_slab_init(&slab, (ArenaConfig){0}) != 0);
+
+  char** ptrs = calloc(count, sizeof(char*));
+
+  for (int64_t i = 0; i < count; i++) {
+    size_t size = (i * 97) % (ARENA_SLAB_MAX_SIZE + 1024);
+    ptrs[i] = arena_slab_malloc(&slab, size);
+    ARENA_ASSERT(ptrs[i] != 0);
+    ARENA_ASSERT(((uintptr_t)ptrs[i] & 15) == 0);
+    ARENA_ASSERT(size > ARENA_SLAB_MAX_SIZE || arena_slab_size(&slab, ptrs[i]) >= size);
+    memset(ptrs[i], i & 0xff, size);
+  }
+
+  for (int64_t i = 0; i < count; i += 2) {
+    ARENA_ASSERT(arena_slab_free(&slab, ptrs[i]) != 0);
+    ptrs[i] = 0;
+  }
+
+  for (int64_t i = 1; i < count; i += 2) {
+    size_t size = (i * 97) % (ARENA_SLAB_MAX_SIZE + 1024);
+    for (size_t j = 0; j < size; j++)
+      ARENA_ASSERT((unsigned char)ptrs[i][j] == (i & 0xff));
+  }
+
+  // freed slots of a class are handed out again.
+  char* first = arena_slab_malloc(&slab, 40);
+  ARENA_ASSERT(arena_slab_free(&slab, first) != 0);
+  ARENA_ASSERT(arena_slab_malloc(&slab, 33) == first);
+
+  // small classes carry no per-object header.
+  char* a = arena_slab_malloc(&slab, 16);
+  char* b = arena_slab_malloc(&slab, 16);
+  ARENA_ASSERT(slab.classes[0].slot_size == 16);
+  ARENA_ASSERT(b - a == 16 || a - b == 16);
+  ARENA_ASSERT(arena_slab_free(&slab, a) != 0);
+  ARENA_ASSERT(arena_slab_free(&slab, b) != 0);
+
+  for (int64_t i = 1; i < count; i += 2)
+    ARENA_ASSERT(arena_slab_free(&slab, ptrs[i]) != 0);
+
+  free(ptrs);
+  arena_slab_destroy(&slab);
+}
+
+static void count_free(void* data, void* user_ptr) {
+  (*(int64_t*)user_ptr)++;
+}
+
+static int64_t count_pages(Arena* arena) {
+  int64_t pages = 0;
+  for (Arena* page = arena; page != 0; page = page->next) pages++;
+  return pages;
+}
+
+// a failed oversized request does not get in the way of small ones.
+void test_arena_malloc_size_failure() {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .bump = true, .page_size = 4096 });
+
+  ARENA_ASSERT(arena_malloc_size(&arena, 64, 8) != 0);
+  int64_t pages = count_pages(&arena);
+
+  ARENA_ASSERT(arena_malloc_size(&arena, (size_t)1 << 60, 8) == 0);
+  ARENA_ASSERT(count_pages(&arena) == pages);
+
+  for (int64_t i = 0; i < 100; i++) {
+    char* s = arena_malloc_size(&arena, 64, 8);
+    ARENA_ASSERT(s != 0);
+    memset(s, 1, 64);
+  }
+
+  arena_destroy(&arena);
+}
+
+void test_arena_mark_rewind(int64_t count, int64_t items_per_page) {
+  int64_t freed = 0;
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page, .free_function_with_user_ptr = count_free, .user_ptr_free = &freed });
+
+  int64_t** values = calloc(count, sizeof(int64_t*));
+
+  for (int64_t i = 0; i < count; i++) {
+    values[i] = arena_malloc(&arena, 0);
+    *values[i] = i;
+  }
+
+  ArenaMark outer = arena_mark(&arena);
+  for (int64_t i = 0; i < count; i++) arena_malloc(&arena, 0);
+
+  ArenaMark inner = arena_mark(&arena);
+  ArenaHandle handle = ARENA_HANDLE_NULL;
+  ARENA_ASSERT(arena_malloc_handle(&arena, &handle) != 0);
+  for (int64_t i = 1; i < count / 2; i++) arena_malloc(&arena, 0);
+
+  // one contiguous batch that has to go on a new tail page.
+  ARENA_ASSERT(arena_malloc_n(&arena, items_per_page * 2, 0, 0, ARENA_MALLOC_CONTIGUOUS) == items_per_page * 2);
+
+  ARENA_ASSERT(arena_rewind(&arena, inner) != 0);
+  ARENA_ASSERT(freed == count / 2 + items_per_page * 2);
+  ARENA_ASSERT(arena_get(&arena, handle) == 0);
+
+  int64_t pages = count_pages(&arena);
+
+  ARENA_ASSERT(arena_rewind(&arena, outer) != 0);
+  ARENA_ASSERT(freed == count + count / 2 + items_per_page * 2);
+  ARENA_ASSERT(arena_rewind(&arena, inner) == 0);
+
+  for (int64_t i = 0; i < count; i++) ARENA_ASSERT(*values[i] == i);
+
+  // rewound pages are reused before the arena grows.
+  for (int64_t i = 0; i < count; i++) arena_malloc(&arena, 0);
+  ARENA_ASSERT(count_pages(&arena) == pages);
+
+  free(values);
+  arena_destroy(&arena);
+
+  Arena scratch = {0};
+  arena_init(&scratch, (ArenaConfig){ .bump = true, .page_size = 256 });
+
+  ArenaMark start = arena_mark(&scratch);
+  char* first = arena_malloc_size(&scratch, 16, 0);
+
+  for (int depth = 0; depth < 4; depth++) {
+    ArenaMark phase = arena_mark(&scratch);
+    char* a = arena_malloc_size(&scratch, 100, 8);
+    for (int64_t i = 0; i < 50; i++) arena_malloc_size(&scratch, 1 + i * 7, 8);
+    arena_malloc_size(&scratch, 1000, 8);
+    ARENA_ASSERT(arena_rewind(&scratch, phase) != 0);
+    ARENA_ASSERT(arena_malloc_size(&scratch, 100, 8) == a);
+    ARENA_ASSERT(arena_rewind(&scratch, phase) != 0);
+  }
+
+  ARENA_ASSERT(arena_rewind(&scratch, start) != 0);
+  ARENA_ASSERT(arena_malloc_size(&scratch, 16, 0) == first);
+
+  arena_destroy(&scratch);
+}
+
+void test_arena_mark_invalidation() {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = 16 });
+
+  // older pages bump allocated from after the mark are cut back too.
+  for (int i = 0; i < 3; i++)
+    ARENA_ASSERT(arena_malloc_n(&arena, 10, 0, 0, ARENA_MALLOC_CONTIGUOUS) == 10);
+
+  ArenaMark mark = arena_mark(&arena);
+  for (int i = 0; i < 8; i++) ARENA_ASSERT(arena_malloc(&arena, 0) != 0);
+  ARENA_ASSERT(arena_rewind(&arena, mark) != 0);
+
+  ArenaStats stats = {0};
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  ARENA_ASSERT(stats.live == 30);
+
+  // a rewind drops the marks taken after its own for good.
+  ArenaMark m1 = arena_mark(&arena);
+  arena_malloc(&arena, 0);
+  ArenaMark m2 = arena_mark(&arena);
+  arena_malloc(&arena, 0);
+  ARENA_ASSERT(arena_rewind(&arena, m1) != 0);
+  ArenaMark m3 = arena_mark(&arena);
+  arena_malloc(&arena, 0);
+  ARENA_ASSERT(arena_rewind(&arena, m2) == 0);
+  ARENA_ASSERT(arena_rewind(&arena, m3) != 0);
+  ARENA_ASSERT(arena_rewind(&arena, m1) != 0);
+
+  // slots recycled from the free list after the mark are freed again.
+  ArenaRef recycled[4];
+  ARENA_ASSERT(arena_malloc_n(&arena, 4, 0, recycled, 0) == 4);
+  ARENA_ASSERT(arena_free_n(recycled, 4) == 4);
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  int64_t live = stats.live;
+
+  ArenaMark reuse = arena_mark(&arena);
+  ArenaHandle handle = ARENA_HANDLE_NULL;
+  ARENA_ASSERT(arena_malloc_handle(&arena, &handle) != 0);
+  for (int i = 0; i < 5; i++) ARENA_ASSERT(arena_malloc(&arena, 0) != 0);
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0 && stats.live == live + 6);
+
+  ARENA_ASSERT(arena_rewind(&arena, reuse) != 0);
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  ARENA_ASSERT(stats.live == live && stats.free >= 4);
+  ARENA_ASSERT(arena_get(&arena, handle) == 0);
+  arena_destroy(&arena);
+
+  // releasing the page a mark points at invalidates it.
+  Arena defrag = {0};
+  arena_init(&defrag, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = 16 });
+
+  ArenaRef refs[40];
+  ARENA_ASSERT(arena_malloc_n(&defrag, 40, 0, refs, 0) == 40);
+
+  ArenaMark late = arena_mark(&defrag);
+  for (int i = 16; i < 40; i++) ARENA_ASSERT(arena_free(refs[i]) != 0);
+
+  int64_t pages = count_pages(&defrag);
+  ARENA_ASSERT(arena_defrag(&defrag) != 0);
+  ARENA_ASSERT(count_pages(&defrag) < pages);
+  ARENA_ASSERT(arena_rewind(&defrag, late) == 0);
+
+  ArenaMark again = arena_mark(&defrag);
+  ARENA_ASSERT(arena_malloc(&defrag, 0) != 0);
+  ARENA_ASSERT(arena_rewind(&defrag, again) != 0);
+  arena_destroy(&defrag);
+}
+
+typedef struct {
+  int64_t items;
+  int64_t calls;
+} DestroyCount;
+
+static void count_free_batch(void** items, int64_t n, void* user_ptr) {
+  DestroyCount* count = (DestroyCount*)user_ptr;
+  for (int64_t i = 0; i < n; i++) ARENA_ASSERT(*(int64_t*)items[i] >= 0);
+  count->items += n;
+  count->calls++;
+}
+
+void test_arena_destroy_policy(int64_t count, int64_t items_per_page, ArenaDestroyPolicy policy) {
+  DestroyCount destroyed = {0};
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page, .free_batch_function = count_free_batch, .user_ptr_free = &destroyed, .destroy_policy = policy });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+  ARENA_ASSERT(arena_malloc_n(&arena, count, 0, refs, 0) == count);
+  for (int64_t i = 0; i < count; i++) *(int64_t*)refs[i].ptr = i;
+
+  ARENA_ASSERT(arena_free_n(refs, count / 2) == count / 2);
+
+  int64_t pages = (count / 2 + items_per_page - 1) / items_per_page;
+
+  if (policy == ARENA_DESTROY_EAGER) {
+    ARENA_ASSERT(destroyed.items == count / 2 && destroyed.calls == pages);
+  } else {
+    ARENA_ASSERT(destroyed.items == 0);
+  }
+
+  void** ptrs = calloc(count, sizeof(void*));
+  ARENA_ASSERT(arena_malloc_n(&arena, count / 2, ptrs, 0, 0) == count / 2);
+  for (int64_t i = 0; i < count / 2; i++) *(int64_t*)ptrs[i] = i;
+
+  if (policy == ARENA_DESTROY_LAZY) {
+    // recycled slots are destroyed one at a time on the allocation path.
+    ARENA_ASSERT(destroyed.items == count / 2 && destroyed.calls == count / 2);
+  } else if (policy == ARENA_DESTROY_DEFERRED) {
+    // nothing was reusable, the batch went to new pages.
+    ARENA_ASSERT(destroyed.items == 0);
+    ARENA_ASSERT(arena_collect(&arena) == count / 2);
+    ARENA_ASSERT(destroyed.items == count / 2 && destroyed.calls == pages);
+    ARENA_ASSERT(arena_collect(&arena) == 0);
+
+    ArenaRef ref = {0};
+    ARENA_ASSERT(arena_malloc(&arena, &ref) != 0);
+    ARENA_ASSERT(ref.arena->index < pages);
+    *(int64_t*)ref.ptr = 0;
+  }
+
+  // a single free destroys just its own object and recycles the slot.
+  if (policy == ARENA_DESTROY_EAGER) {
+    int64_t calls = destroyed.calls;
+    ArenaRef ref = {0};
+    ARENA_ASSERT(arena_malloc(&arena, &ref) != 0);
+    *(int64_t*)ref.ptr = 0;
+    ARENA_ASSERT(arena_free(ref) != 0);
+    ARENA_ASSERT(destroyed.calls == calls + 1);
+
+    ArenaRef again = {0};
+    ARENA_ASSERT(arena_malloc(&arena, &again) == ref.ptr);
+    *(int64_t*)again.ptr = 0;
+  }
+
+  int64_t before = destroyed.items;
+  int64_t live = 0;
+  for (Arena* page = &arena; page != 0; page = page->next)
+    for (int64_t i = 0; i < page->malloc_length; i++)
+      live += ARENA_BIT_TEST(page->live_bits, i) != 0;
+
+  arena_destroy(&arena);
+  ARENA_ASSERT(destroyed.items - before == live);
+
+  free(ptrs);
+  free(refs);
+}
+
+void test_arena_page_pool(int64_t count, int64_t items_per_page) {
+  ArenaPagePool pool = {0};
+  ARENA_ASSERT(arena_page_pool_init(&pool, 0) != 0);
+
+  int64_t pages = (count + items_per_page - 1) / items_per_page;
+  void** data = calloc(pages, sizeof(void*));
+  Arena** table = 0;
+
+  // per request arenas: the second one is built from the first one's pages.
+  for (int request = 0; request < 3; request++) {
+    Arena arena = {0};
+    arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page, .page_pool = &pool });
+
+    for (int64_t i = 0; i < count; i++) *(int64_t*)arena_malloc(&arena, 0) = i;
+
+    ARENA_ASSERT(count_pages(&arena) == pages);
+    ARENA_ASSERT(request == 0 || pool.length == 0);
+
+    // and from its page table.
+    if (request == 0) table = arena.page_table;
+    ARENA_ASSERT(arena.page_table == table && pool.page_table == 0);
+
+    int64_t i = 0;
+    for (Arena* page = &arena; page != 0; page = page->next, i++) {
+      if (request == 0) {
+        data[i] = page->data;
+        continue;
+      }
+
+      bool found = false;
+      for (int64_t j = 0; j < pages; j++) found = found || data[j] == page->data;
+      ARENA_ASSERT(found);
+    }
+
+    arena_destroy(&arena);
+    ARENA_ASSERT(pool.length == pages);
+    ARENA_ASSERT(pool.page_table == table);
+  }
+
+  // defragged pages go back to the pool too.
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page, .page_pool = &pool });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+  ARENA_ASSERT(arena_malloc_n(&arena, count, 0, refs, 0) == count);
+  ARENA_ASSERT(pool.length == 0);
+
+  ARENA_ASSERT(arena_free_n(refs + items_per_page, items_per_page) == items_per_page);
+  arena_defrag(&arena);
+  ARENA_ASSERT(pool.length == 1);
+  ARENA_ASSERT(count_pages(&arena) == pages - 1);
+
+  arena_reset(&arena);
+  ARENA_ASSERT(arena_trim(&arena) > 0);
+  ARENA_ASSERT(count_pages(&arena) == 1);
+  ARENA_ASSERT(arena_malloc(&arena, 0) != 0);
+
+  arena_destroy(&arena);
+
+  ARENA_ASSERT(arena_page_pool_trim(&pool, 0) > 0);
+  ARENA_ASSERT(pool.length == 0 && pool.bytes == 0);
+
+  free(refs);
+  free(data);
+  arena_page_pool_destroy(&pool);
+}
+
+void test_arena_defrag_n(int64_t pages, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  int64_t count = pages * items_per_page;
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+  ARENA_ASSERT(arena_malloc_n(&arena, count, 0, refs, 0) == count);
+
+  // empty every other page, the root stays.
+  for (int64_t p = 1; p < pages; p += 2)
+    ARENA_ASSERT(arena_free_n(refs + p * items_per_page, items_per_page) == items_per_page);
+
+  ARENA_ASSERT(arena_defrag_n(&arena, 10) == 10);
+  ARENA_ASSERT(count_pages(&arena) == pages - 10);
+  ARENA_ASSERT(arena_defrag_n(&arena, -1) == pages / 2 - 10);
+  ARENA_ASSERT(count_pages(&arena) == pages - pages / 2);
+  ARENA_ASSERT(arena_defrag(&arena) == 0);
+
+  for (Arena* page = &arena; page != 0; page = page->next)
+    ARENA_ASSERT(!arena_is_clean(page));
+
+  // refilling a page takes it off the empty list again.
+  ARENA_ASSERT(arena_free_n(refs, items_per_page) == items_per_page);
+  ARENA_ASSERT(arena_free_n(refs + 2 * items_per_page, items_per_page) == items_per_page);
+  ARENA_ASSERT(arena_malloc_n(&arena, items_per_page, 0, 0, 0) == items_per_page);
+  ARENA_ASSERT(arena_defrag_n(&arena, -1) == 0);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+static void sum_value(void* user_ptr, void* data_ptr) {
+  *(int64_t*)user_ptr += *(int64_t*)data_ptr;
+}
+
+static void sum_span(void* user_ptr, ArenaSpan span) {
+  ARENA_ASSERT(span.count > 0 && span.count <= 64 && span.live_mask != 0);
+
+  int64_t sum = 0;
+  for (int64_t i = 0; i < span.count; i++) {
+    int64_t value = *(int64_t*)((char*)span.base + i * span.stride);
+    sum += ((span.live_mask >> i) & 1) ? value : 0;
+  }
+
+  *(int64_t*)user_ptr += sum;
+}
+
+void test_arena_for_each(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+  ARENA_ASSERT(arena_malloc_n(&arena, count, 0, refs, 0) == count);
+
+  int64_t expected = 0;
+  int64_t live = 0;
+
+  for (int64_t i = 0; i < count; i++) {
+    *(int64_t*)refs[i].ptr = i;
+
+    if (i % 3 == 0) {
+      ARENA_ASSERT(arena_free(refs[i]) != 0);
+    } else {
+      expected += i;
+      live++;
+    }
+  }
+
+  int64_t sum = 0;
+  ARENA_ASSERT(arena_for_each(&arena, sum_value, &sum) == live);
+  ARENA_ASSERT(sum == expected);
+
+  sum = 0;
+  ARENA_ASSERT(arena_for_each_span(&arena, sum_span, &sum) > 0);
+  ARENA_ASSERT(sum == expected);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+static void parallel_sum(void* user_ptr, void* data_ptr, int64_t thread_index) {
+  int64_t* sums = (int64_t*)user_ptr;
+  int64_t* value = (int64_t*)data_ptr;
+  *value *= 2;
+  sums[thread_index] += *value;
+}
+
+void test_arena_parallel_for_each(int64_t count, int64_t items_per_page, int64_t nthreads) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+  ARENA_ASSERT(arena_malloc_n(&arena, count, 0, refs, 0) == count);
+
+  int64_t expected = 0;
+  int64_t live = 0;
+
+  for (int64_t i = 0; i < count; i++) {
+    *(int64_t*)refs[i].ptr = i;
+
+    if (i % 5 == 0) {
+      ARENA_ASSERT(arena_free(refs[i]) != 0);
+    } else {
+      expected += i * 2;
+      live++;
+    }
+  }
+
+  int64_t sums[ARENA_PARALLEL_MAX_THREADS] = {0};
+  ARENA_ASSERT(arena_parallel_for_each(&arena, parallel_sum, sums, nthreads) == live);
+
+  int64_t total = 0;
+  for (int64_t t = 0; t < ARENA_PARALLEL_MAX_THREADS; t++) total += sums[t];
+  ARENA_ASSERT(total == expected);
+
+  for (int64_t i = 1; i < count; i++)
+    if (i % 5 != 0) ARENA_ASSERT(*(int64_t*)refs[i].ptr == i * 2);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+
+typedef struct {
+  ArenaHandle* handles;
+  int64_t moved;
+  int64_t* times;
+} CompactState;
+
+static void relocate_value(void* user_ptr, void* old_ptr, void* new_ptr, ArenaHandle new_handle) {
+  CompactState* state = (CompactState*)user_ptr;
+  int64_t value = *(int64_t*)new_ptr;
+  ARENA_ASSERT(value == *(int64_t*)old_ptr);
+  state->handles[value] = new_handle;
+  state->moved++;
+  if (state->times) state->times[value]++;
+}
+
+void test_arena_compact(int64_t pages, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  int64_t count = pages * items_per_page;
+  ArenaHandle* handles = calloc(count, sizeof(ArenaHandle));
+  bool* live = calloc(count, sizeof(bool));
+
+  for (int64_t i = 0; i < count; i++) {
+    *(int64_t*)arena_malloc_handle(&arena, &handles[i]) = i;
+    live[i] = true;
+  }
+
+  // even pages keep one object, odd pages keep all but four.
+  for (int64_t i = 0; i < count; i++) {
+    int64_t page = i / items_per_page, slot = i % items_per_page;
+    if ((page % 2 == 0 && slot != 0) || (page % 2 == 1 && slot < 4)) {
+      ARENA_ASSERT(arena_free_handle(&arena, handles[i]) != 0);
+      live[i] = false;
+    }
+  }
+
+  ArenaHandle old = handles[2 * items_per_page];
+  CompactState state = { .handles = handles };
+
+  ARENA_ASSERT(arena_compact(&arena, relocate_value, &state) == pages / 2 - 1);
+  ARENA_ASSERT(state.moved == pages / 2 - 1);
+  ARENA_ASSERT(count_pages(&arena) == pages - (pages / 2 - 1));
+  ARENA_ASSERT(arena_get(&arena, old) == 0);
+
+  for (int64_t i = 0; i < count; i++) {
+    if (!live[i]) continue;
+    int64_t* value = arena_get(&arena, handles[i]);
+    ARENA_ASSERT(value != 0 && *value == i);
+  }
+
+  // nothing sparse is left.
+  ARENA_ASSERT(arena_compact(&arena, relocate_value, &state) == 0);
+
+  free(live);
+  free(handles);
+  arena_destroy(&arena);
+}
+
+// an empty page is not a target, objects moved there would have to move
+// again once it is sparse.
+void test_arena_compact_empty_page(int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  int64_t count = 5 * items_per_page + items_per_page / 2;
+  ArenaHandle* handles = calloc(count, sizeof(ArenaHandle));
+  int64_t* times = calloc(count, sizeof(int64_t));
+
+  for (int64_t i = 0; i < count; i++)
+    *(int64_t*)arena_malloc_handle(&arena, &handles[i]) = i;
+
+  // pages 1 and 3 keep two objects, page 2 none.
+  for (int64_t i = items_per_page; i < 4 * items_per_page; i++) {
+    int64_t page = i / items_per_page, slot = i % items_per_page;
+    if (page == 2 || slot >= 2)
+      ARENA_ASSERT(arena_free_handle(&arena, handles[i]) != 0);
+  }
+
+  CompactState state = { .handles = handles, .times = times };
+  ARENA_ASSERT(arena_compact(&arena, relocate_value, &state) == 2);
+  ARENA_ASSERT(arena_compact(&arena, relocate_value, &state) == 0);
+  ARENA_ASSERT(state.moved == 4);
+
+  for (int64_t i = 0; i < count; i++) ARENA_ASSERT(times[i] <= 1);
+  ARENA_ASSERT(arena_defrag(&arena) != 0);
+
+  for (int64_t i = 0; i < count; i++) {
+    int64_t page = i / items_per_page, slot = i % items_per_page;
+    if (page >= 1 && page <= 3 && (page == 2 || slot >= 2)) continue;
+    int64_t* value = arena_get(&arena, handles[i]);
+    ARENA_ASSERT(value != 0 && *value == i);
+  }
+
+  free(times);
+  free(handles);
+  arena_destroy(&arena);
+}
+
+void test_arena_defrag_step(int64_t pages, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  int64_t count = pages * items_per_page;
+  ArenaHandle* handles = calloc(count, sizeof(ArenaHandle));
+  bool* live = calloc(count, sizeof(bool));
+
+  for (int64_t i = 0; i < count; i++) {
+    *(int64_t*)arena_malloc_handle(&arena, &handles[i]) = i;
+    live[i] = true;
+  }
+
+  // every tenth page from the fifth is emptied, the others are even sparse
+  // and odd dense as in test_arena_compact.
+  int64_t empty = 0, sparse = 0;
+  for (int64_t page = 1; page < pages - 1; page++) {
+    if (page % 10 == 5) empty++;
+    else if (page % 2 == 0) sparse++;
+  }
+
+  for (int64_t i = 0; i < count; i++) {
+    int64_t page = i / items_per_page, slot = i % items_per_page;
+    if (page % 10 == 5 || (page % 2 == 0 && slot != 0) || (page % 2 == 1 && slot < 4)) {
+      ARENA_ASSERT(arena_free_handle(&arena, handles[i]) != 0);
+      live[i] = false;
+    }
+  }
+
+  CompactState state = { .handles = handles };
+  ArenaDefragBudget budget = { .pages = 1, .compact = true };
+  int64_t steps = 1;
+
+  while (arena_defrag_step(&arena, budget, relocate_value, &state)) {
+    steps++;
+    ARENA_ASSERT(steps <= empty + sparse);
+  }
+
+  ARENA_ASSERT(steps == empty + sparse);
+  ARENA_ASSERT(state.moved == sparse);
+  ARENA_ASSERT(count_pages(&arena) == pages - empty - sparse);
+
+  for (int64_t i = 0; i < count; i++) {
+    if (!live[i]) continue;
+    int64_t* value = arena_get(&arena, handles[i]);
+    ARENA_ASSERT(value != 0 && *value == i);
+  }
+
+  // a time budget, nothing is left to do.
+  budget = (ArenaDefragBudget){ .nanoseconds = 1000000, .compact = true };
+  ARENA_ASSERT(!arena_defrag_step(&arena, budget, relocate_value, &state));
+  ARENA_ASSERT(state.moved == sparse);
+
+  free(live);
+  free(handles);
+  arena_destroy(&arena);
+}
+
+void test_arena_get_stats(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+  for (int64_t i = 0; i < count; i++)
+    ARENA_ASSERT(arena_malloc(&arena, &refs[i]) != 0);
+
+  int64_t freed = 0;
+  for (int64_t i = 0; i < count; i += 3) {
+    ARENA_ASSERT(arena_free(refs[i]) != 0);
+    freed++;
+  }
+
+  ArenaStats stats = {0};
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  ARENA_ASSERT(stats.pages == count_pages(&arena));
+  ARENA_ASSERT(stats.new_page_count == stats.pages - 1);
+  ARENA_ASSERT(stats.live == count - freed);
+  ARENA_ASSERT(stats.free == freed && stats.pending == 0);
+  ARENA_ASSERT(stats.carved == count && stats.capacity >= count);
+  ARENA_ASSERT(stats.bytes_used == (count - freed) * (int64_t)sizeof(int64_t));
+  ARENA_ASSERT(stats.bytes_reserved >= count * (int64_t)sizeof(int64_t));
+  ARENA_ASSERT(stats.high_water_bytes == stats.bytes_reserved);
+  ARENA_ASSERT(stats.fragmentation > 0.3 && stats.fragmentation < 0.4);
+  ARENA_ASSERT(stats.bump_count == count && stats.reuse_count == 0);
+  ARENA_ASSERT(stats.backing & ARENA_BACKING_HEAP);
+
+  // the freed slots are taken first.
+  for (int64_t i = 0; i < freed; i++)
+    ARENA_ASSERT(arena_malloc(&arena, 0) != 0);
+
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  ARENA_ASSERT(stats.free == 0 && stats.fragmentation == 0.0);
+  ARENA_ASSERT(stats.reuse_count == freed && stats.bump_count == count);
+
+  // reset keeps the pages, defrag gives them back.
+  int64_t pages = stats.pages;
+  arena_reset(&arena);
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  ARENA_ASSERT(stats.pages == pages && stats.live == 0 && stats.carved == 0);
+
+  for (int64_t i = 0; i < count; i++)
+    ARENA_ASSERT(arena_malloc(&arena, &refs[i]) != 0);
+  for (int64_t i = items_per_page; i < count; i++)
+    ARENA_ASSERT(arena_free(refs[i]) != 0);
+
+  int64_t high_water = stats.high_water_bytes;
+  ARENA_ASSERT(arena_defrag(&arena) != 0);
+  ARENA_ASSERT(arena_get_stats(&arena, &stats) != 0);
+  ARENA_ASSERT(stats.bytes_reserved < high_water);
+  ARENA_ASSERT(stats.high_water_bytes == high_water);
+  ARENA_ASSERT(arena.bytes == stats.bytes_reserved);
+
+  free(refs);
+  arena_destroy(&arena);
+
+  // bump mode counts bytes handed out.
+  Arena bump = {0};
+  arena_init(&bump, (ArenaConfig){ .bump = true, .page_size = 4096 });
+  for (int64_t i = 0; i < count; i++)
+    ARENA_ASSERT(arena_malloc_size(&bump, 64, 8) != 0);
+
+  ARENA_ASSERT(arena_get_stats(&bump, &stats) != 0);
+  ARENA_ASSERT(stats.live == count && stats.bytes_used == count * 64);
+  ARENA_ASSERT(stats.carved == 0 && stats.fragmentation == 0.0);
+  ARENA_ASSERT(stats.bump_count == count);
+  arena_destroy(&bump);
+}
+
+#ifdef ARENA_PROFILE
+static int64_t sum_buckets(ArenaProfileOp op) {
+  int64_t buckets[ARENA_PROFILE_BUCKETS] = {0};
+  ARENA_ASSERT(arena_profile_histogram(op, buckets) != 0);
+
+  int64_t sum = 0;
+  for (int64_t i = 0; i < ARENA_PROFILE_BUCKETS; i++) sum += buckets[i];
+  return sum;
+}
+
+void test_arena_profile(int64_t count, int64_t items_per_page) {
+  Arena arena = {0};
+  arena_init(&arena, (ArenaConfig){ .item_size = sizeof(int64_t), .items_per_page = items_per_page });
+
+  ArenaRef* refs = calloc(count, sizeof(ArenaRef));
+
+  arena_profile_clear();
+  ARENA_ASSERT(arena_profile_start(16) != 0);
+
+  for (int64_t i = 0; i < count; i++)
+    ARENA_ASSERT(arena_malloc(&arena, &refs[i]) != 0);
+  for (int64_t i = 0; i < count; i += 2)
+    ARENA_ASSERT(arena_free(refs[i]) != 0);
+  arena_reset(&arena);
+
+  ARENA_ASSERT(arena_profile_stop() != 0);
+
+  // stopped, nothing more is recorded.
+  ARENA_ASSERT(arena_malloc(&arena, 0) != 0);
+
+  ARENA_ASSERT(sum_buckets(ARENA_PROFILE_MALLOC) == count);
+  ARENA_ASSERT(sum_buckets(ARENA_PROFILE_FREE) == (count + 1) / 2);
+  ARENA_ASSERT(sum_buckets(ARENA_PROFILE_RESET) == 1);
+
+  const char* path = "/tmp/arena_profile_test.json";
+  ARENA_ASSERT(arena_profile_dump(path, ARENA_PROFILE_JSON) != 0);
+
+  FILE* fp = fopen(path, "r");
+  ARENA_ASSERT(fp != 0);
+  char report[1 << 14] = {0};
+  fread(report, 1, sizeof(report) - 1, fp);
+  fclose(fp);
+  remove(path);
+
+  // every allocation came from the one loop above.
+  char expected[128];
+  snprintf(expected, sizeof(expected), "\"samples\": %ld, \"objects\": %ld, \"new_pages\": %ld",
+           count / 16, count / 16, count_pages(&arena) - 1);
+  ARENA_ASSERT(strstr(report, expected) != 0);
+  ARENA_ASSERT(strstr(report, "\"op\": \"reset\", \"calls\": 1,") != 0);
+
+  free(refs);
+  arena_destroy(&arena);
+}
+#endif
+
 static void custom_free_function_with_ptr(void *data, void *user_ptr) {
   ARENA_ASSERT(data != 0);
   ARENA_ASSERT(user_ptr != 0);
@@ -355,6 +1697,48 @@ int main(int argc, char* argv[]) {
   test_arena_randomly_free(1000, 16);
   test_arena_randomly_reset(500, 16);
   test_arena_custom_free_function_ptr(1000, 16);
+  test_arena_many_pages(200000, 4);
+  test_arena_free_list(1001, 16);
+  test_arena_iterate_and_clean(1000, 130);
+  test_arena_growth(10000, ARENA_GROWTH_DOUBLE, 12);
+  test_arena_growth(10000, ARENA_GROWTH_DOUBLE_CAPPED, 4 + 10000 / 64);
+  test_arena_growth(1000, ARENA_GROWTH_FIXED, 250);
+  test_arena_virtual_memory(100000);
+  test_arena_huge_pages(2048);
+  test_arena_shared(8, 1000);
+  test_arena_remote_free(10000);
+  test_arena_remote_free_concurrent(100000);
+  test_arena_remote_double_free(1000);
+  test_arena_malloc_n(1000, 16);
+  test_arena_free_n_and_if(1000, 16);
+  test_arena_handles(1000, 16);
+  test_arena_handle_churn((1 << 20) + 1000);
+  test_arena_malloc_size(10000, false);
+  test_arena_malloc_size(10000, true);
+  test_arena_malloc_size_reserve(10240 * 1024);
+  test_arena_malloc_size_failure();
+  test_arena_slab(5000);
+  test_arena_mark_rewind(1000, 16);
+  test_arena_mark_rewind(1000, 130);
+  test_arena_mark_invalidation();
+  test_arena_destroy_policy(1000, 16, ARENA_DESTROY_LAZY);
+  test_arena_destroy_policy(1000, 16, ARENA_DESTROY_EAGER);
+  test_arena_destroy_policy(1000, 130, ARENA_DESTROY_DEFERRED);
+  test_arena_page_pool(1000, 16);
+  test_arena_defrag_n(100000, 4);
+  test_arena_for_each(1000, 16);
+  test_arena_for_each(1000, 300);
+  test_arena_parallel_for_each(100000, 4096, 4);
+  test_arena_parallel_for_each(100000, 16, 0);
+  test_arena_parallel_for_each(1000, 16, 1);
+  arena_parallel_shutdown();
+  test_arena_compact(100, 16);
+  test_arena_compact_empty_page(16);
+  test_arena_defrag_step(100, 16);
+  test_arena_get_stats(1000, 16);
+#ifdef ARENA_PROFILE
+  test_arena_profile(1000, 16);
+#endif
  // test_arena_various_page_size(1000, 256);
   //test_arena_randomly_free(1000, 256);
 